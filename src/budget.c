@@ -0,0 +1,205 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Priorities for the budget of files.
+
+   Each counter is a file, and a process can only open so many. When
+   the budget is exhausted, the counters of the least active tasks are
+   closed (the task is "evicted") to make room, and opened again when
+   the task becomes active (see process.c).
+
+   Candidates are kept in two binary heaps, keyed by the %CPU of the
+   last refresh: a min-heap of the tasks that hold counters, and a
+   max-heap of the evicted tasks. They are built in O(n) at most once
+   per refresh, the first time they are needed, then each eviction or
+   re-attachment costs O(log n). Entries are not updated when a task
+   changes state: stale ones are dropped when they reach the top.
+
+   The tasks the user asked for (watched, or selected with -p) are
+   pinned: they are never evicted, and re-attached first.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "budget.h"
+
+
+struct heap_entry {
+  double key;
+  struct process* p;
+};
+
+struct heap {
+  struct heap_entry* e;
+  int num;
+  int alloc;
+  int max;  /* 1 for a max-heap, 0 for a min-heap */
+};
+
+static struct heap cold = { NULL, 0, 0, 0 };  /* tasks holding counters */
+static struct heap hot  = { NULL, 0, 0, 1 };  /* evicted tasks */
+
+static const struct process_list* cur_list = NULL;
+static int built = 0;
+
+
+/* Does entry 'a' belong above entry 'b' in heap 'h'? */
+static inline int above(const struct heap* const h,
+                        const struct heap_entry* a,
+                        const struct heap_entry* b)
+{
+  return h->max ? (a->key > b->key) : (a->key < b->key);
+}
+
+
+static void sift_down(struct heap* const h, int i)
+{
+  for(;;) {
+    int top = i;
+    const int l = 2 * i + 1;
+    const int r = l + 1;
+    struct heap_entry tmp;
+
+    if ((l < h->num) && above(h, &h->e[l], &h->e[top]))
+      top = l;
+    if ((r < h->num) && above(h, &h->e[r], &h->e[top]))
+      top = r;
+    if (top == i)
+      return;
+    tmp = h->e[i];
+    h->e[i] = h->e[top];
+    h->e[top] = tmp;
+    i = top;
+  }
+}
+
+
+static void push(struct heap* const h, struct process* p, double key)
+{
+  if (h->num == h->alloc) {
+    h->alloc = h->alloc ? 2 * h->alloc : 64;
+    h->e = realloc(h->e, h->alloc * sizeof(struct heap_entry));
+  }
+  h->e[h->num].key = key;
+  h->e[h->num].p = p;
+  h->num++;
+}
+
+
+static void pop(struct heap* const h)
+{
+  if (h->num == 0)
+    return;
+  h->e[0] = h->e[--h->num];
+  sift_down(h, 0);
+}
+
+
+/* Is 'p' one of the tasks the user explicitly asked for? */
+int budget_pinned(const struct process* const p,
+                  const struct option* const options)
+{
+  if (options->watch_pid &&
+      ((p->tid == options->watch_pid) || (p->pid == options->watch_pid)))
+    return 1;
+  if (options->only_pid &&
+      ((p->tid == options->only_pid) || (p->pid == options->only_pid)))
+    return 1;
+  if (options->watch_name && p->name && strstr(p->name, options->watch_name))
+    return 1;
+  return 0;
+}
+
+
+/* Fill both heaps from the current list, then heapify bottom-up. */
+static void build(const struct option* const options)
+{
+  int i;
+
+  cold.num = 0;
+  hot.num = 0;
+  for(i = 0; i < cur_list->num_tids; i++) {
+    struct process* const p = cur_list->proc_ptrs[i];
+
+    if (p->dead || p->inactive || (p->tid < 0))
+      continue;
+    if (p->evicted)
+      push(&hot, p, budget_pinned(p, options) ? HUGE_VAL : p->cpu_percent);
+    else if (has_counters(p) && !budget_pinned(p, options))
+      push(&cold, p, p->cpu_percent);
+  }
+  for(i = cold.num / 2 - 1; i >= 0; i--)
+    sift_down(&cold, i);
+  for(i = hot.num / 2 - 1; i >= 0; i--)
+    sift_down(&hot, i);
+  built = 1;
+}
+
+
+/* Forget the heaps: the tasks of 'list' have been sampled again, or
+   some were freed. */
+void budget_invalidate(const struct process_list* const list)
+{
+  cur_list = list;
+  built = 0;
+}
+
+
+void budget_fini(void)
+{
+  free(cold.e);
+  free(hot.e);
+  cold.e = hot.e = NULL;
+  cold.num = cold.alloc = hot.num = hot.alloc = 0;
+  cur_list = NULL;
+  built = 0;
+}
+
+
+/* Least active task that still holds counters, or NULL. */
+struct process* budget_coldest(const struct option* const options)
+{
+  if (!cur_list)
+    return NULL;
+  if (!built)
+    build(options);
+  while (cold.num &&
+         (cold.e[0].p->dead || cold.e[0].p->evicted ||
+          !has_counters(cold.e[0].p)))
+    pop(&cold);
+  return cold.num ? cold.e[0].p : NULL;
+}
+
+
+/* Most active evicted task, or NULL. */
+struct process* budget_hottest(const struct option* const options)
+{
+  if (!cur_list)
+    return NULL;
+  if (!built)
+    build(options);
+  while (hot.num && (hot.e[0].p->dead || !hot.e[0].p->evicted))
+    pop(&hot);
+  return hot.num ? hot.e[0].p : NULL;
+}
+
+
+void budget_pop_coldest(void)
+{
+  pop(&cold);
+}
+
+
+void budget_pop_hottest(void)
+{
+  pop(&hot);
+}
@@ -0,0 +1,28 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+#ifndef _BUDGET_H
+#define _BUDGET_H
+
+#include "options.h"
+#include "process.h"
+
+void budget_invalidate(const struct process_list* const list);
+void budget_fini(void);
+
+int  budget_pinned(const struct process* const p,
+                   const struct option* const options);
+
+struct process* budget_coldest(const struct option* const options);
+struct process* budget_hottest(const struct option* const options);
+void budget_pop_coldest(void);
+void budget_pop_hottest(void);
+
+#endif  /* _BUDGET_H */
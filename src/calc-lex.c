@@ -0,0 +1,193 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Scanner of the column and counter expressions, for the pure parser
+   of calc.y. It replaces the flex scanner calc.lex, with the same
+   tokens:
+
+     blank     [ \t\n]+                       ignored
+     keywords  delta rate ewma wmin wmax wavg and or shr shl
+     symbols   | + - * / ^ ( ) ,
+     base16    0x[0-9A-Fa-f]+
+     constant  [0-9]+("."[0-9]+)?([eE][+-]?[0-9]+)?
+     word      [A-Za-z][A-Za-z0-9_]*
+
+   As with flex, the longest match wins, and a keyword is only a
+   keyword when the word stops there ("deltas" is a counter). A
+   character that starts no token is returned as is, the parser
+   reports the syntax error (flex used to print it and go on).
+
+   The state is allocated for each expression (see parser_expression),
+   there is no global.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "formula-parser.h"
+#include "y.tab.h"
+
+struct scanner {
+  const char* next;  /* rest of the input */
+  char*  text;       /* last token, for the error messages */
+  size_t text_alloc;
+};
+
+static const struct {
+  const char* name;
+  int token;
+} keywords[] = {
+  { "delta", DELTA },
+  { "rate",  RATE },
+  { "ewma",  EWMA },
+  { "wmin",  WMIN },
+  { "wmax",  WMAX },
+  { "wavg",  WAVG },
+  { "and",   AND },
+  { "or",    OR },
+  { "shr",   SHR },
+  { "shl",   SHL }
+};
+
+
+int yyerror(void* scanner, expression** result, const char* s);
+
+
+/* Scanner of 'txt', which must outlive it. */
+void* calc_scanner_new(const char* txt)
+{
+  struct scanner* sc = malloc(sizeof(struct scanner));
+
+  sc->next = txt;
+  sc->text_alloc = 32;
+  sc->text = malloc(sc->text_alloc);
+  sc->text[0] = '\0';
+  return sc;
+}
+
+
+void calc_scanner_free(void* scanner)
+{
+  struct scanner* const sc = scanner;
+
+  free(sc->text);
+  free(sc);
+}
+
+
+/* The token is the next 'len' characters of the input. */
+static const char* take(struct scanner* sc, size_t len)
+{
+  if (len + 1 > sc->text_alloc) {
+    sc->text_alloc = len + 1;
+    sc->text = realloc(sc->text, sc->text_alloc);
+  }
+  memcpy(sc->text, sc->next, len);
+  sc->text[len] = '\0';
+  sc->next += len;
+  return sc->text;
+}
+
+
+/* Length of the constant at 's' (at least one digit). The fraction
+   and the exponent are only part of it when they have digits. */
+static size_t constant_len(const char* s)
+{
+  size_t n = 0, m;
+
+  while (isdigit((unsigned char)s[n]))
+    n++;
+  if ((s[n] == '.') && isdigit((unsigned char)s[n + 1])) {
+    n++;
+    while (isdigit((unsigned char)s[n]))
+      n++;
+  }
+  if ((s[n] == 'e') || (s[n] == 'E')) {
+    m = n + 1;
+    if ((s[m] == '+') || (s[m] == '-'))
+      m++;
+    if (isdigit((unsigned char)s[m])) {
+      while (isdigit((unsigned char)s[m]))
+        m++;
+      n = m;
+    }
+  }
+  return n;
+}
+
+
+int yylex(YYSTYPE* yylval, void* scanner)
+{
+  struct scanner* const sc = scanner;
+  const char* s;
+  size_t n, i;
+
+  while ((*sc->next == ' ') || (*sc->next == '\t') || (*sc->next == '\n'))
+    sc->next++;
+  s = sc->next;
+
+  if (*s == '\0') {
+    sc->text[0] = '\0';
+    return 0;  /* end of input */
+  }
+
+  if ((s[0] == '0') && (s[1] == 'x') && isxdigit((unsigned char)s[2])) {
+    n = 3;
+    while (isxdigit((unsigned char)s[n]))
+      n++;
+    yylval->txt = strdup(take(sc, n));
+    return BASE16;
+  }
+
+  if (isdigit((unsigned char)*s)) {
+    yylval->txt = strdup(take(sc, constant_len(s)));
+    return NUMBER;
+  }
+
+  if (isalpha((unsigned char)*s)) {
+    n = 1;
+    while (isalnum((unsigned char)s[n]) || (s[n] == '_'))
+      n++;
+    take(sc, n);
+    for(i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+      if (strcmp(sc->text, keywords[i].name) == 0)
+        return keywords[i].token;
+    }
+    yylval->txt = strdup(sc->text);
+    return COUNTER;
+  }
+
+  take(sc, 1);
+  switch (*sc->text) {
+  case '|': return OR;
+  case '+': return ADD;
+  case '-': return SUB;
+  case '*': return MUL;
+  case '/': return DIV;
+  case '^': return POWER;
+  case '(': return B_LEFT;
+  case ')': return B_RIGHT;
+  case ',': return COMMA;
+  default:  return (unsigned char)*sc->text;
+  }
+}
+
+
+int yyerror(void* scanner, expression** result, const char* s)
+{
+  const struct scanner* const sc = scanner;
+
+  (void)result;
+  error_printf("Expression: %s at '%s'\n", s, sc->text);
+  return 0;
+}
@@ -18,18 +18,24 @@
 #include "error.h"
 #include "utils-expression.h"
 
-extern expression* res_expr;
-
 expression* build_node_operation(expression* exp1, expression* exp2, int opera);
 expression* build_node_counter(char* alias, int delta);
 expression* build_node_constant(char* txt);
+expression* build_node_function(int func, expression* arg, char* param);
 
 
 int yylex();
-int yyerror(char *s);
+int yyerror(void* scanner, expression** result, const char* s);
 
 %}
 
+/* Reentrant: no global state, the scanner and the location of the
+   result are passed by parser_expression. */
+%define api.pure
+%parse-param { void* scanner }
+%parse-param { expression** result }
+%lex-param { void* scanner }
+
 
 %union {
     expression* e;
@@ -46,8 +52,13 @@ int yyerror(char *s);
 %token B_LEFT B_RIGHT
 %token END
 %token DELTA
+%token RATE EWMA WMIN WMAX WAVG COMMA
+
+%type <e> Expression
 
-%type <e> Expression Line
+/* values dropped on a syntax error */
+%destructor { free($$); } <txt>
+%destructor { free_expression($$); } Expression
 
 %left ADD SUB AND OR SHR SHL
 %left MUL  DIV
@@ -56,7 +67,7 @@ int yyerror(char *s);
 %start Line
 %%
 
-Line: Expression     { res_expr = $1; };
+Line: Expression     { *result = $1; };
 
 Expression:
 
@@ -70,9 +81,24 @@ NUMBER   {
 | DELTA B_LEFT COUNTER B_RIGHT  {
     $$ = build_node_counter($3, DELT);
 }
+| RATE B_LEFT COUNTER B_RIGHT  {
+    $$ = build_node_counter($3, PERSEC);
+}
 | COUNTER {
     $$ = build_node_counter($1, 0);
 }
+| EWMA B_LEFT Expression COMMA NUMBER B_RIGHT  {
+    $$ = build_node_function('e', $3, $5);
+}
+| WMIN B_LEFT Expression COMMA NUMBER B_RIGHT  {
+    $$ = build_node_function('m', $3, $5);
+}
+| WMAX B_LEFT Expression COMMA NUMBER B_RIGHT  {
+    $$ = build_node_function('M', $3, $5);
+}
+| WAVG B_LEFT Expression COMMA NUMBER B_RIGHT  {
+    $$ = build_node_function('a', $3, $5);
+}
 | Expression ADD Expression  {
     $$ = build_node_operation($1,$3, '+');
 }
@@ -122,8 +148,8 @@ expression* build_node_counter(char* alias, int delta)
   tmp->ele = alloc_unit();
   tmp->ele->alias = alias;
   tmp->ele->type = COUNT;
-  if (delta == DELT) {
-    tmp->ele->delta = DELT;
+  if ((delta == DELT) || (delta == PERSEC)) {
+    tmp->ele->delta = delta;
   }
   tmp->type = ELEM;
   return tmp;
@@ -147,3 +173,32 @@ expression* build_node_constant(char* txt)
   free(txt);
   return tmp;
 }
+
+
+/* Function of the values of 'arg' over time (see the program of a
+   screen in utils-expression.c): 'e' for ewma, whose parameter is the
+   weight of the new value, 'm', 'M', 'a' for the min, max and average
+   over a window of the last 'param' values. Represented as an
+   operation, with the parameter as second operand. */
+expression* build_node_function(int func, expression* arg, char* param)
+{
+  expression* tmp = build_node_operation(arg,
+                                         build_node_constant(param),
+                                         func);
+  const expression* const p = tmp->op->exp2;
+
+  if (p->type == ERROR)
+    tmp->type = ERROR;
+  else if ((func == 'e') && ((p->ele->val <= 0) || (p->ele->val > 1))) {
+    error_printf("Weight of ewma must be in ]0, 1], not %g\n", p->ele->val);
+    tmp->type = ERROR;
+  }
+  else if ((func != 'e') &&
+           ((p->ele->val < 1) || (p->ele->val > WINDOW_MAX) ||
+            (p->ele->val != (int)p->ele->val))) {
+    error_printf("Window must be an integer in [1, %d], not %g\n",
+                 WINDOW_MAX, p->ele->val);
+    tmp->type = ERROR;
+  }
+  return tmp;
+}
@@ -0,0 +1,306 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Counting per cgroup (--cgroup DIR): one row per sub-directory of
+   DIR, typically one per container. The counters of the screen are
+   opened once per cgroup and per CPU with PERF_FLAG_PID_CGROUP: the
+   kernel counts all the tasks of the cgroup, whatever their number
+   and lifetime, and nothing has to be attached when tasks come and
+   go. The cost is cgroups x CPUs x events files.
+
+   The per-CPU counter sets are not rows of the list, they are summed
+   into the row of their cgroup at each refresh. %CPU comes from the
+   cpu.stat file of the cgroup (cgroup v2).
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cgroup.h"
+#include "error.h"
+#include "pmc.h"
+#include "priv.h"
+#include "proc-parser.h"
+
+#ifndef PERF_FLAG_PID_CGROUP  /* Linux 2.6.39 */
+#define PERF_FLAG_PID_CGROUP (1UL << 2)
+#endif
+
+struct cgroup {
+  struct process*  row;   /* displayed row, owned by the list */
+  struct process** sets;  /* one counter set per CPU, not in the list */
+  char*  name;            /* name of the directory */
+  int    dir_fd;          /* the cgroup, as passed to perf_event_open */
+  ino_t  ino;             /* detects a cgroup removed and re-created */
+  unsigned gen;           /* last scan where the directory was seen */
+  struct cgroup* next;
+};
+
+static struct cgroup* cgroups = NULL;
+static int* cpus = NULL;  /* online CPUs */
+static int  num_cpus = 0;
+static int  next_id = 1;  /* IDs of the rows, in the PID column */
+
+
+/* Get the list of online CPUs, from the cpu lines of /proc/stat. */
+static int init_cpus()
+{
+  struct cpu_stat st;
+  const char* p;
+  char* buf;
+  int   size = 256 + 128 * sysconf(_SC_NPROCESSORS_CONF);
+
+  buf = malloc(size);
+  if (read_proc_file("/proc/stat", buf, size) == -1) {
+    free(buf);
+    return -1;
+  }
+  cpus = malloc(sysconf(_SC_NPROCESSORS_CONF) * sizeof(int));
+  num_cpus = 0;
+  for(p = buf; (p = parse_cpu_stat(p, &st)); ) {
+    if (st.cpu >= 0)
+      cpus[num_cpus++] = st.cpu;
+  }
+  free(buf);
+  return 0;
+}
+
+
+static struct cgroup* new_cgroup(struct process_list* const list,
+                                 const screen_t* const screen,
+                                 struct STRUCT_NAME* events,
+                                 int dir_fd, ino_t ino, const char* name)
+{
+  struct cgroup* c = malloc(sizeof(struct cgroup));
+  int i;
+
+  c->row = add_pseudo_task(list, next_id++, name);
+  c->row->num_events = screen->num_counters;
+  for(i = 0; i < screen->num_counters; i++) {
+    c->row->fd[i] = -1;  /* never read, values come from the sets */
+    c->row->values[i] = 0;
+  }
+
+  c->name = strdup(name);
+  c->dir_fd = dir_fd;
+  c->ino = ino;
+  c->sets = malloc(num_cpus * sizeof(struct process*));
+  restore_privilege();
+  for(i = 0; i < num_cpus; i++) {
+    struct process* set = new_counter_set(c->row->tid, c->name,
+                                          screen->num_counters);
+    open_counters(set, screen, events, dir_fd, cpus[i],
+                  PERF_FLAG_PID_CGROUP);
+    c->sets[i] = set;
+  }
+  drop_privilege();
+
+  c->next = cgroups;
+  cgroups = c;
+  return c;
+}
+
+
+/* Release the counters of a cgroup. Its row is left to the list. */
+static void free_cgroup(struct cgroup* c)
+{
+  int i;
+
+  for(i = 0; i < num_cpus; i++) {
+    close_files(c->sets[i]);
+    free(c->sets[i]);
+  }
+  free(c->sets);
+  free(c->name);
+  close(c->dir_fd);
+  release_file();
+  free(c);
+}
+
+
+/* %CPU of the cgroup, from the cumulated times of cpu.stat. */
+static void cgroup_cpu_percent(struct cgroup* c)
+{
+  char buf[1024];
+  unsigned long long user = 0, system = 0;
+  const long clk_tck = sysconf(_SC_CLK_TCK);
+  const char* p;
+  int fd, n;
+
+  fd = openat(c->dir_fd, "cpu.stat", O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {  /* cgroup v1, or no cpu controller */
+    update_interval(c->row);  /* still a refresh, for rate... */
+    return;
+  }
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0) {
+    update_interval(c->row);
+    return;
+  }
+  buf[n] = '\0';
+
+  if ((p = strstr(buf, "user_usec ")))
+    user = strtoull(p + 10, NULL, 10);
+  if ((p = strstr(buf, "system_usec ")))
+    system = strtoull(p + 12, NULL, 10);
+
+  /* microseconds to clock ticks, like /proc/PID/stat */
+  update_cpu_percent(c->row, user * clk_tck / 1000000,
+                     system * clk_tck / 1000000);
+}
+
+
+/*
+ * Refresh the list of cgroups (sub-directories of options->cgroup_dir)
+ * and their counters. Return the number of dead rows.
+ */
+int update_cgroup_list(struct process_list* const list,
+                       const screen_t* const screen,
+                       const struct option* const options)
+{
+  static unsigned gen = 0;
+  struct STRUCT_NAME events;
+  struct cgroup** pc;
+  struct dirent*  dir;
+  DIR*  root;
+  int   num_dead = 0;
+  int   i;
+
+  if (!cpus && (init_cpus() == -1))
+    return 0;
+
+  root = opendir(options->cgroup_dir);
+  if (!root) {
+    error_printf("Could not open cgroup directory '%s': %s\n",
+                 options->cgroup_dir, strerror(errno));
+    return 0;
+  }
+
+  init_events_attr(&events, options);
+  gen++;
+
+  /* find new cgroups */
+  while ((dir = readdir(root))) {
+    struct cgroup* c;
+    struct stat st;
+    int fd;
+
+    if ((dir->d_type != DT_DIR) || (dir->d_name[0] == '.'))
+      continue;
+    if (fstatat(dirfd(root), dir->d_name, &st, 0) == -1)
+      continue;
+
+    for(c = cgroups; c; c = c->next) {
+      if ((c->ino == st.st_ino) && (strcmp(c->name, dir->d_name) == 0))
+        break;
+    }
+    if (!c) {
+      /* the directory stays open, for perf_event_open */
+      if (!take_file()) {
+        error_printf("Files limit reached for cgroup %s\n", dir->d_name);
+        continue;
+      }
+      fd = openat(dirfd(root), dir->d_name,
+                  O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (fd == -1) {
+        release_file();
+        continue;
+      }
+      c = new_cgroup(list, screen, &events, fd, st.st_ino, dir->d_name);
+    }
+    c->gen = gen;
+  }
+  closedir(root);
+
+  /* sample the live ones, drop those that disappeared */
+  pc = &cgroups;
+  while (*pc) {
+    struct cgroup* const c = *pc;
+
+    if (c->gen != gen) {
+      c->row->dead = 1;
+      *pc = c->next;
+      free_cgroup(c);
+      continue;
+    }
+
+    cgroup_cpu_percent(c);
+    for(i = 0; i < num_cpus; i++) {
+      int zz;
+      for(zz = 0; zz < c->sets[i]->num_events; zz++)
+        c->sets[i]->prev_values[zz] = c->sets[i]->values[zz];
+      read_counters(c->sets[i]);
+    }
+    sum_counters(c->row, (const struct process* const*)c->sets, num_cpus);
+    pc = &c->next;
+  }
+
+  for(i = 0; i < list->num_tids; i++) {
+    if (list->proc_ptrs[i]->dead)
+      num_dead++;
+  }
+  return num_dead;
+}
+
+
+/* Forget all cgroups, when the list of rows is deleted. */
+void done_cgroup_list()
+{
+  while (cgroups) {
+    struct cgroup* c = cgroups;
+    cgroups = c->next;
+    free_cgroup(c);
+  }
+  next_id = 1;
+}
+
+
+/* Return 1 if process 'pid' belongs to cgroup 'path' (relative to the
+   root of the hierarchy, e.g. /system.slice/foo.service) or to one of
+   its descendants. All hierarchies listed in /proc/PID/cgroup are
+   considered. */
+int in_cgroup(int pid, const char* path)
+{
+  char  name[50];
+  char  buf[4096];
+  const char* p;
+  const size_t len = strlen(path);
+
+  if (len == 0)
+    return 1;
+  snprintf(name, sizeof(name), "/proc/%d/cgroup", pid);
+  if (read_proc_file(name, buf, sizeof(buf)) == -1)
+    return 0;
+
+  /* lines are "hierarchy-ID:controller-list:cgroup-path" */
+  for(p = buf; *p; ) {
+    const char* eol = strchr(p, '\n');
+    const char* cg = strchr(p, ':');
+    if (cg)
+      cg = strchr(cg + 1, ':');
+    if (!eol)
+      eol = p + strlen(p);
+    if (cg && (cg < eol)) {
+      cg++;
+      if ((strncmp(cg, path, len) == 0) &&
+          ((cg + len == eol) || (cg[len] == '/') || (path[len-1] == '/')))
+        return 1;
+    }
+    p = *eol ? eol + 1 : eol;
+  }
+  return 0;
+}
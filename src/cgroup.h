@@ -0,0 +1,24 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+#ifndef _CGROUP_H
+#define _CGROUP_H
+
+#include "options.h"
+#include "process.h"
+#include "screen.h"
+
+int  update_cgroup_list(struct process_list* const list,
+                        const screen_t* const screen,
+                        const struct option* const options);
+void done_cgroup_list(void);
+int  in_cgroup(int pid, const char* path);
+
+#endif  /* _CGROUP_H */
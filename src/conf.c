@@ -124,10 +124,18 @@ static int dump_options(FILE* out, struct option* opt)
     return -1;
   if (dump_option_int(out, "max_iter", opt->max_iter) < 0)
     return -1;
+  if (dump_option_int(out, "jobs", opt->num_jobs) < 0)
+    return -1;
+  if (dump_option_int(out, "per_cpu", opt->per_cpu) < 0)
+    return -1;
   if (dump_option_string(out, "only_name", opt->only_name) < 0)
     return -1;
   if (dump_option_int(out, "only_pid",(int) opt->only_pid) < 0)
     return -1;
+  if (dump_option_string(out, "cgroup", opt->cgroup_dir) < 0)
+    return -1;
+  if (dump_option_string(out, "only_cgroup", opt->only_cgroup) < 0)
+    return -1;
   if  (dump_option_int(out, "debug", opt->debug) < 0)
     return -1;
   if (dump_option_int(out, "batch", opt->batch) < 0)
@@ -72,7 +72,8 @@ void init_errors(int batch_mode, const char* error_file_name)
 void error_printf(char* fmt, ...)
 {
   va_list args;
-  nb_error++;
+  /* also called by the worker threads, stdio locks the file itself */
+  __sync_fetch_and_add(&nb_error, 1);
 
   if (!error_file)
     return;
@@ -18,6 +18,7 @@ typedef enum {
   OPER,
   ELEM,
   DELT,
+  PERSEC,  /* rate(counter): variation per second */
   ERROR
 } type_t;
 
@@ -25,38 +25,43 @@
 #include "config.h"
 #include "hash.h"
 
-#define NUM_HASH_KEYS 16  /* must be a power of 2 */
+/* bounds of the number of buckets, powers of 2 */
+#define MIN_HASH_KEYS 16
+#define MAX_HASH_KEYS 65536
 
 struct hash_entry {
   struct process* data;
   struct hash_entry* next;
 };
 
-static struct hash_entry* hash_map[NUM_HASH_KEYS];
+static struct hash_entry** hash_map = NULL;
+static int num_hash_keys = 0;  /* always a power of 2 */
 
 
 /* simplest possible hash function */
 static inline int hash(int x)
 {
-  return x & (NUM_HASH_KEYS - 1);
+  return x & (num_hash_keys - 1);
 }
 
 
-/* Just initialize the buckets to NULL */
-void hash_init()
+/* Allocate the buckets, about one per expected entry, and initialize
+   them to NULL. */
+void hash_init(int num_expected)
 {
-  int i;
-  assert((NUM_HASH_KEYS & (NUM_HASH_KEYS - 1)) == 0);  /* power of 2 */
-  for(i=0; i < NUM_HASH_KEYS; i++)
-    hash_map[i] = NULL;
+  num_hash_keys = MIN_HASH_KEYS;
+  while ((num_hash_keys < num_expected) && (num_hash_keys < MAX_HASH_KEYS))
+    num_hash_keys *= 2;
+  assert((num_hash_keys & (num_hash_keys - 1)) == 0);  /* power of 2 */
+  hash_map = calloc(num_hash_keys, sizeof(struct hash_entry*));
 }
 
 
-/* Deallocate all entries, and reset the buckets to NULL. */
+/* Deallocate all entries and the buckets. */
 void hash_fini()
 {
   int i;
-  for(i=0; i < NUM_HASH_KEYS; i++) {
+  for(i=0; i < num_hash_keys; i++) {
     struct hash_entry* ptr = hash_map[i];
     while (ptr) {
       struct hash_entry* next = ptr->next;
@@ -65,6 +70,9 @@ void hash_fini()
     }
     hash_map[i] = NULL;
   }
+  free(hash_map);
+  hash_map = NULL;
+  num_hash_keys = 0;
 }
 
 
@@ -74,7 +82,7 @@ void hash_dump()
 {
   int i;
   printf("---------------\n");
-  for(i=0; i < NUM_HASH_KEYS; i++) {
+  for(i=0; i < num_hash_keys; i++) {
     struct hash_entry* ptr = hash_map[i];
     if (ptr)
       printf("[%3d] ", i);
@@ -150,3 +158,78 @@ void hash_del(int key)
   }
   assert(0);
 }
+
+
+/* Set of the PIDs seen in /proc, used to skip already known processes
+   when scanning. Same structure as above, with more buckets since it
+   holds all the processes of the system. */
+
+#define NUM_KNOWN_KEYS 4096  /* must be a power of 2 */
+
+static struct known_pid* known_map[NUM_KNOWN_KEYS];
+
+
+void known_init()
+{
+  int i;
+  assert((NUM_KNOWN_KEYS & (NUM_KNOWN_KEYS - 1)) == 0);  /* power of 2 */
+  for(i=0; i < NUM_KNOWN_KEYS; i++)
+    known_map[i] = NULL;
+}
+
+
+void known_fini()
+{
+  known_purge(-1);  /* no entry was seen in this generation */
+}
+
+
+struct known_pid* known_get(pid_t pid)
+{
+  struct known_pid* ptr = known_map[pid & (NUM_KNOWN_KEYS - 1)];
+
+  while (ptr) {
+    if (ptr->pid == pid)
+      return ptr;
+    ptr = ptr->next;
+  }
+  return NULL;
+}
+
+
+/* Insert a new PID, the caller fills in the fields. */
+struct known_pid* known_add(pid_t pid)
+{
+  int h = pid & (NUM_KNOWN_KEYS - 1);
+  struct known_pid* new = malloc(sizeof(struct known_pid));
+
+  new->pid = pid;
+  new->ino = 0;
+  new->nlink = 0;
+  new->gen = 0;
+  new->skipped = 0;
+  new->owner = -1;
+  new->name[0] = '\0';
+  new->next = known_map[h];
+  known_map[h] = new;
+  return new;
+}
+
+
+/* Delete all entries that were not seen in generation 'gen'. */
+void known_purge(unsigned int gen)
+{
+  int i;
+  for(i=0; i < NUM_KNOWN_KEYS; i++) {
+    struct known_pid** pptr = &known_map[i];
+    while (*pptr) {
+      struct known_pid* ptr = *pptr;
+      if (ptr->gen != gen) {
+        *pptr = ptr->next;
+        free(ptr);
+      }
+      else
+        pptr = &ptr->next;
+    }
+  }
+}
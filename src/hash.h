@@ -11,13 +11,34 @@
 #ifndef _HASH_H
 #define _HASH_H
 
+#include <sys/types.h>
+
 #include "process.h"
 
 
-void hash_init();
+/* A PID seen during the last scan of /proc, monitored or not. */
+struct known_pid {
+  pid_t    pid;
+  ino_t    ino;      /* inode of /proc/PID, changes when the PID is reused */
+  nlink_t  nlink;    /* links of /proc/PID/task: changes with the threads */
+  unsigned int gen;  /* last scan in which the PID was seen */
+  unsigned int skipped : 1;  /* filtered out, not monitored */
+  uid_t    owner;    /* of /proc/PID, when it was filtered out */
+  char     name[16]; /* comm, when it was filtered out */
+  struct known_pid* next;
+};
+
+
+void hash_init(int num_expected);
 void hash_fini();
 void hash_add(int key, struct process* proc);
 struct process* hash_get(int key);
 void hash_del(int key);
 
+void known_init();
+void known_fini();
+struct known_pid* known_get(pid_t pid);
+struct known_pid* known_add(pid_t pid);
+void known_purge(unsigned int gen);
+
 #endif  /* _HASH_H */
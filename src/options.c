@@ -32,6 +32,7 @@ static void usage(const char* name)
   fprintf(stderr, "\t-b             ignored, for compatibility with batch mode\n");
 #endif
   fprintf(stderr, "\t-c             use command line instead of process name\n");
+  fprintf(stderr, "\t--cgroup dir   one row per cgroup found in dir\n");
   fprintf(stderr, "\t--cpu-min m    minimum %%CPU to display a process\n");
   fprintf(stderr, "\t-d delay       delay in seconds between refreshes\n");
   fprintf(stderr, "\t-E filename    file where errors are logged\n");
@@ -43,11 +44,14 @@ static void usage(const char* name)
   fprintf(stderr, "\t-H             show threads\n");
   fprintf(stderr, "\t-K --kernel    show kernel activity\n");
   fprintf(stderr, "\t-i             also display idle processes\n");
+  fprintf(stderr, "\t--in-cgroup path  only display tasks of this cgroup\n");
+  fprintf(stderr, "\t--jobs num     number of threads sampling the tasks\n");
   fprintf(stderr, "\t--list-screens display list of available screens\n");
   fprintf(stderr, "\t-n num         max number of refreshes\n");
   fprintf(stderr, "\t--no-collect   no attempt to collect idle processes when out of files\n");
   fprintf(stderr, "\t-o outfile     output file in batch mode\n");
   fprintf(stderr, "\t--only-conf    disable default screen, only configuration\n");
+  fprintf(stderr, "\t--per-cpu      system-wide mode, one row per CPU\n");
   fprintf(stderr, "\t-p --pid pid|name  only display task with this PID/name\n");
   fprintf(stderr, "\t-S num         screen number to display\n");
   fprintf(stderr, "\t--sticky       keep final status of dead processes\n");
@@ -73,6 +77,7 @@ void init_options(struct option* opt)
   opt->cpu_threshold = 0.00001;
   opt->default_screen = 1;
   opt->delay = 2;
+  opt->num_jobs = 1;
   opt->out = stdout;
   opt->watch_uid = -1;
   opt->error = 0;
@@ -84,6 +89,10 @@ void free_options(struct option* options)
     free(options->watch_name);
   if (options->only_name)
     free(options->only_name);
+  if (options->cgroup_dir)
+    free(options->cgroup_dir);
+  if (options->only_cgroup)
+    free(options->only_cgroup);
 }
 
 
@@ -176,6 +185,20 @@ void parse_command_line(int argc, char* argv[],
       continue;
     }
 
+    if (strcmp(argv[i], "--cgroup") == 0) {
+      if (i+1 < argc) {
+        if (options->cgroup_dir)
+          free(options->cgroup_dir);
+        options->cgroup_dir = strdup(argv[i+1]);
+        i++;
+        continue;
+      }
+      else {
+        fprintf(stderr, "Missing directory after --cgroup.\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+
     if (strcmp(argv[i], "--cpu-min") == 0) {
       if (i+1 < argc) {
         options->cpu_threshold = (float)atof(argv[i+1]);
@@ -261,6 +284,34 @@ void parse_command_line(int argc, char* argv[],
       }
     }
 
+    if (strcmp(argv[i], "--in-cgroup") == 0) {
+      if (i+1 < argc) {
+        if (options->only_cgroup)
+          free(options->only_cgroup);
+        options->only_cgroup = strdup(argv[i+1]);
+        i++;
+        continue;
+      }
+      else {
+        fprintf(stderr, "Missing cgroup after --in-cgroup.\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    if (strcmp(argv[i], "--jobs") == 0) {
+      if (i+1 < argc) {
+        options->num_jobs = atoi(argv[i+1]);
+        if (options->num_jobs < 1)
+          options->num_jobs = 1;
+        i++;
+        continue;
+      }
+      else {
+        fprintf(stderr, "Missing number of jobs after --jobs.\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+
     if (strcmp(argv[i], "--list-screens") == 0) {
       *list_scr = 1;
       continue;
@@ -305,6 +356,11 @@ void parse_command_line(int argc, char* argv[],
       continue;
     }
 
+    if (strcmp(argv[i], "--per-cpu") == 0) {
+      options->per_cpu = 1;
+      continue;
+    }
+
     if ((strcmp(argv[i], "-p") == 0) || (strcmp(argv[i], "--pid") == 0)) {
       if (i+1 < argc) {
         options->only_pid = atoi(argv[i+1]);
@@ -21,8 +21,11 @@ struct option {
   float  delay;
   float  cpu_threshold;  /* CPU activity below which a thread is considered inactive */
   int    max_iter;
+  int    num_jobs;  /* threads used to sample the tasks */
   char*  only_name;
   int    only_pid;
+  char*  cgroup_dir;   /* one row per sub-directory (cgroup mode) */
+  char*  only_cgroup;  /* only tasks of this cgroup */
   int    paranoia_level;
   char*  watch_name;
   pid_t  watch_pid;
@@ -40,6 +43,7 @@ struct option {
   unsigned int    error : 2;
   unsigned int    idle : 1;
   unsigned int    no_collect : 1;
+  unsigned int    per_cpu : 1;
   unsigned int    show_cmdline : 1;
   unsigned int    show_epoch : 1;
   unsigned int    show_kernel : 1;
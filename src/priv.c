@@ -10,6 +10,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -24,6 +25,12 @@
    risk). To minimize the risk, we immediately drop root privilege,
    and restore it only for the time of the perf_event_open system
    call.
+
+   The user ID is per process: changing it while other threads open
+   counters would pull the rug from under them. Only the main thread
+   restores and drops the privilege, once around a whole batch of
+   counters attached by the worker threads (see process.c). The calls
+   nest.
  */
 
 
@@ -31,6 +38,25 @@
 static uid_t euid = -1;
 static uid_t uid =  -1;
 
+/* Depth of nested restore_privilege calls, main thread only. */
+static int raised = 0;
+
+/* Limit of open files before raise_files_limit. */
+static struct rlimit orig_files_limit;
+static int files_limit_saved = 0;
+
+
+/* Switch the effective user ID to 'id', abort on failure. */
+static void set_euid(uid_t id)
+{
+  int res = seteuid(id);
+  if (res == -1) {
+    /* do not proceed as somebody else */
+    fprintf(stderr, "Cannot change privileges. Aborting.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
 
 /* Used for initial call. We check and store uid and effective uid,
    and drop any extra privilege we might have. */
@@ -38,7 +64,8 @@ uid_t init_drop_privilege()
 {
   euid = geteuid();
   uid = getuid();
-  drop_privilege();
+  if (euid != uid)
+    set_euid(uid);
 
   return euid;
 }
@@ -48,14 +75,11 @@ uid_t init_drop_privilege()
 /* This is where we drop privilege. */
 void drop_privilege()
 {
+  if (--raised > 0)  /* still needed outside */
+    return;
   if (euid != uid) {
     /* only do it if needed, otherwise skip  the call */
-    int res = seteuid(uid);
-    if (res == -1) {
-      /* do not proceed as somebody else */
-      fprintf(stderr, "Cannot change privileges. Aborting.\n");
-      exit(EXIT_FAILURE);
-    }
+    set_euid(uid);
   }
 }
 
@@ -64,6 +88,8 @@ void drop_privilege()
    saved when we droped privilege. It can be restored. */
 void restore_privilege()
 {
+  if (raised++ > 0)  /* already restored */
+    return;
   if (euid != uid) {
     /* only do it if needed, otherwise skip  the call */
     int res = seteuid(euid);
@@ -74,3 +100,61 @@ void restore_privilege()
     }
   }
 }
+
+
+/* Each counter is a file: raise the limit of open files as much as
+   allowed. The soft limit goes up to the hard limit and, with root
+   privilege, both go up to fs.nr_open, the most the kernel accepts
+   for a process. Return the resulting soft limit. The original limit
+   is kept for the spawned command, see restore_files_limit. */
+rlim_t raise_files_limit()
+{
+  struct rlimit lim;
+  rlim_t nr_open = RLIM_INFINITY;
+  rlim_t target;
+  FILE*  f;
+
+  if (getrlimit(RLIMIT_NOFILE, &lim) == -1)
+    return 0;
+  orig_files_limit = lim;
+  files_limit_saved = 1;
+
+  f = fopen("/proc/sys/fs/nr_open", "r");
+  if (f) {
+    unsigned long val;
+    if (fscanf(f, "%lu", &val) == 1)
+      nr_open = val;
+    fclose(f);
+  }
+
+  if ((euid == 0) && (nr_open != RLIM_INFINITY) &&
+      (lim.rlim_max != RLIM_INFINITY) && (lim.rlim_max < nr_open)) {
+    struct rlimit raised;
+    raised.rlim_cur = nr_open;
+    raised.rlim_max = nr_open;
+    restore_privilege();
+    if (setrlimit(RLIMIT_NOFILE, &raised) == 0)
+      lim = raised;
+    drop_privilege();
+  }
+
+  target = lim.rlim_max;
+  if ((target == RLIM_INFINITY) || (target > nr_open))
+    target = nr_open;
+  if ((target != RLIM_INFINITY) && (lim.rlim_cur < target)) {
+    struct rlimit raised = lim;
+    raised.rlim_cur = target;
+    if (setrlimit(RLIMIT_NOFILE, &raised) == 0)
+      lim = raised;
+  }
+  return lim.rlim_cur;
+}
+
+
+/* Give back the limit of open files found by raise_files_limit, in a
+   command spawned by tiptop: it must run as it would without it. */
+void restore_files_limit()
+{
+  if (files_limit_saved)
+    setrlimit(RLIMIT_NOFILE, &orig_files_limit);
+}
@@ -11,10 +11,13 @@
 #ifndef _PRIV_H
 #define _PRIV_H
 
+#include <sys/resource.h>
 #include <sys/types.h>
 
 uid_t init_drop_privilege(void);
 void drop_privilege(void);
 void restore_privilege(void);
+rlim_t raise_files_limit(void);
+void restore_files_limit(void);
 
 #endif  /* _PRIV_H */
@@ -0,0 +1,204 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Event-driven discovery of tasks through the proc connector.
+
+   Instead of rescanning /proc each time a new PID appears, we
+   subscribe to the fork/exec/exit notifications multicast by the
+   kernel on the NETLINK_CONNECTOR socket. Subscribing requires
+   CAP_NET_ADMIN: privileges, if any, are restored for the time of the
+   subscription (see priv.c). When the socket is not available, the
+   caller falls back to scanning /proc.
+ */
+
+#include <errno.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "priv.h"
+#include "proc-events.h"
+
+#define RCVBUF_SIZE (1 << 20)  /* room for bursts of fork/exit events */
+
+static int nl_sock = -1;
+
+
+/* Send a LISTEN (or IGNORE) request to the proc connector. */
+static int subscribe(enum proc_cn_mcast_op op)
+{
+  char buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(op))]
+           __attribute__((aligned(NLMSG_ALIGNTO)));
+  struct nlmsghdr* nlh = (struct nlmsghdr*)buf;
+  struct cn_msg*   msg;
+
+  memset(buf, 0, sizeof(buf));
+  nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+  nlh->nlmsg_type = NLMSG_DONE;
+  nlh->nlmsg_pid = getpid();
+
+  msg = NLMSG_DATA(nlh);
+  msg->id.idx = CN_IDX_PROC;
+  msg->id.val = CN_VAL_PROC;
+  msg->len = sizeof(op);
+  memcpy(msg->data, &op, sizeof(op));
+
+  if (send(nl_sock, nlh, nlh->nlmsg_len, 0) != nlh->nlmsg_len)
+    return -1;
+  return 0;
+}
+
+
+/* Open the netlink socket and subscribe to process events. Return 0
+   on success, -1 if events are not available (not privileged, old
+   kernel, no CONFIG_PROC_EVENTS...). */
+int proc_events_init()
+{
+  struct sockaddr_nl addr;
+  int size = RCVBUF_SIZE;
+
+  if (nl_sock != -1)  /* already done */
+    return 0;
+
+  /* restore super powers, if any, for the time of the subscription */
+  restore_privilege();
+
+  nl_sock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                   NETLINK_CONNECTOR);
+  if (nl_sock == -1)
+    goto fail;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = CN_IDX_PROC;
+  addr.nl_pid = 0;  /* let the kernel pick a port ID */
+  if (bind(nl_sock, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+    goto fail;
+
+  /* bursts of forks must not overflow the socket, try to get a large
+     buffer (the FORCE variant also requires CAP_NET_ADMIN) */
+  if (setsockopt(nl_sock, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)))
+    setsockopt(nl_sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+  if (subscribe(PROC_CN_MCAST_LISTEN) == -1)
+    goto fail;
+
+  drop_privilege();
+  return 0;
+
+ fail:
+  debug_printf("Process events not available (%s), scanning /proc\n",
+               strerror(errno));
+  if (nl_sock != -1)
+    close(nl_sock);
+  nl_sock = -1;
+  drop_privilege();
+  return -1;
+}
+
+
+int proc_events_active()
+{
+  return (nl_sock != -1);
+}
+
+
+/* Read pending events, at most 'max'. Return the number of events
+   stored in 'evs', or -1 when some events were lost (the socket
+   overflowed, or 'max' was too small for a message). In this case,
+   the caller must rescan /proc to recover. */
+int proc_events_read(struct proc_ev* evs, int max)
+{
+  char buf[4096] __attribute__((aligned(NLMSG_ALIGNTO)));
+  int  num = 0;
+  int  lost = 0;
+
+  if (nl_sock == -1)
+    return -1;
+
+  while (num < max) {
+    struct sockaddr_nl from;
+    socklen_t from_len = sizeof(from);
+    struct nlmsghdr* nlh;
+    ssize_t len;
+
+    len = recvfrom(nl_sock, buf, sizeof(buf), 0,
+                   (struct sockaddr*)&from, &from_len);
+    if (len == -1) {
+      if (errno == ENOBUFS) {  /* overflow, events were dropped */
+        lost = 1;
+        continue;
+      }
+      break;  /* EAGAIN: nothing more to read */
+    }
+
+    if (from.nl_pid != 0)  /* only trust messages from the kernel */
+      continue;
+
+    for(nlh = (struct nlmsghdr*)buf; NLMSG_OK(nlh, len);
+        nlh = NLMSG_NEXT(nlh, len)) {
+      struct cn_msg*     msg;
+      struct proc_event* ev;
+
+      if (nlh->nlmsg_type != NLMSG_DONE)
+        continue;
+
+      msg = NLMSG_DATA(nlh);
+      if ((msg->id.idx != CN_IDX_PROC) || (msg->id.val != CN_VAL_PROC))
+        continue;
+
+      if (num == max) {  /* no room left for this one */
+        lost = 1;
+        break;
+      }
+
+      ev = (struct proc_event*)msg->data;
+      switch (ev->what) {
+      case PROC_EVENT_FORK:
+        evs[num].type = PROC_EV_FORK;
+        evs[num].pid = ev->event_data.fork.child_tgid;
+        evs[num].tid = ev->event_data.fork.child_pid;
+        num++;
+        break;
+      case PROC_EVENT_EXEC:
+        evs[num].type = PROC_EV_EXEC;
+        evs[num].pid = ev->event_data.exec.process_tgid;
+        evs[num].tid = ev->event_data.exec.process_pid;
+        num++;
+        break;
+      case PROC_EVENT_EXIT:
+        evs[num].type = PROC_EV_EXIT;
+        evs[num].pid = ev->event_data.exit.process_tgid;
+        evs[num].tid = ev->event_data.exit.process_pid;
+        num++;
+        break;
+      default:  /* uid, gid, sid, ptrace, comm... not interesting */
+        break;
+      }
+    }
+  }
+
+  return lost ? -1 : num;
+}
+
+
+void proc_events_fini()
+{
+  if (nl_sock == -1)
+    return;
+  subscribe(PROC_CN_MCAST_IGNORE);
+  close(nl_sock);
+  nl_sock = -1;
+}
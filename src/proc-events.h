@@ -0,0 +1,37 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+#ifndef _PROC_EVENTS_H
+#define _PROC_EVENTS_H
+
+#include <sys/types.h>
+
+
+enum proc_ev_type {
+  PROC_EV_FORK,
+  PROC_EV_EXEC,
+  PROC_EV_EXIT
+};
+
+
+/* Simplified view of a kernel process event. */
+struct proc_ev {
+  enum proc_ev_type type;
+  pid_t pid;  /* thread group ID */
+  pid_t tid;  /* thread ID */
+};
+
+
+int  proc_events_init(void);
+int  proc_events_active(void);
+int  proc_events_read(struct proc_ev* evs, int max);
+void proc_events_fini(void);
+
+#endif  /* _PROC_EVENTS_H */
@@ -0,0 +1,217 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Dedicated parsers for the few files of /proc read at each
+   refresh. They replace fscanf and its long format strings that skip
+   dozens of fields: buffers are tokenized in a single forward pass,
+   without allocation.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "proc-parser.h"
+
+
+/* Read a (small) file of /proc in 'buf', null terminated. Return the
+   number of bytes read, or -1. */
+int read_proc_file(const char* path, char* buf, int size)
+{
+  int fd, n;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+  n = read(fd, buf, size - 1);
+  close(fd);
+  if (n <= 0)
+    return -1;
+  buf[n] = '\0';
+  return n;
+}
+
+
+/* Skip 'num' space separated fields. */
+static const char* skip_fields(const char* p, int num)
+{
+  while (num-- > 0) {
+    while (*p && (*p != ' '))
+      p++;
+    while (*p == ' ')
+      p++;
+  }
+  return p;
+}
+
+
+/* Read an unsigned decimal number, return pointer past its end and
+   the following spaces, or NULL if no digit. */
+static const char* read_ulong(const char* p, unsigned long long* val)
+{
+  unsigned long long v = 0;
+
+  if ((*p < '0') || (*p > '9'))
+    return NULL;
+  while ((*p >= '0') && (*p <= '9'))
+    v = v * 10 + (*p++ - '0');
+  while (*p == ' ')
+    p++;
+  *val = v;
+  return p;
+}
+
+
+/* Parse the content of /proc/PID/stat or /proc/PID/task/TID/stat.
+
+   The second field is the command name in parentheses. It may
+   contain anything, including spaces and parentheses. None of the
+   following fields contains a ')': the command ends at the last one.
+
+   Return 0 on success, -1 if the line is malformed. A missing
+   processor field (very old kernels) is not an error. */
+int parse_stat(const char* buf, struct task_stat* st)
+{
+  const char* p;
+  unsigned long long val;
+
+  p = strrchr(buf, ')');
+  if (!p || (p[1] != ' ') || !p[2])
+    return -1;
+  p += 2;
+
+  st->state = *p;  /* field 3 */
+  p = skip_fields(p, 11);  /* fields 3 to 13 */
+
+  if (!(p = read_ulong(p, &val)))  /* field 14 */
+    return -1;
+  st->utime = val;
+  if (!(p = read_ulong(p, &val)))  /* field 15 */
+    return -1;
+  st->stime = val;
+
+  p = skip_fields(p, 6);  /* fields 16 to 21 */
+  if (!(p = read_ulong(p, &val)))  /* field 22 */
+    return -1;
+  st->starttime = val;
+
+  p = skip_fields(p, 16);  /* fields 23 to 38 */
+  if ((p = read_ulong(p, &val)))  /* field 39 */
+    st->processor = (int)val;
+  else
+    st->processor = -1;
+
+  return 0;
+}
+
+
+/* Parse the content of /proc/PID/status for the name, real user ID
+   and number of threads of the process. Return 0 if all three were
+   found, -1 otherwise. */
+int parse_status(const char* buf, char* name, int name_size,
+                 int* uid, int* num_threads)
+{
+  const char* p = buf;
+  int found = 0;
+
+  while (*p && (found != 7)) {
+    const char* eol = strchr(p, '\n');
+    if (!eol)
+      eol = p + strlen(p);
+
+    if (strncmp(p, "Name:", 5) == 0) {
+      int len;
+      p += 5;
+      while ((*p == ' ') || (*p == '\t'))
+        p++;
+      len = eol - p;
+      if (len > name_size - 1)
+        len = name_size - 1;
+      memcpy(name, p, len);
+      name[len] = '\0';
+      found |= 1;
+    }
+    else if (strncmp(p, "Uid:", 4) == 0) {
+      *uid = atoi(p + 4);  /* atoi skips the leading tab */
+      found |= 2;
+    }
+    else if (strncmp(p, "Threads:", 8) == 0) {
+      *num_threads = atoi(p + 8);
+      found |= 4;
+    }
+
+    p = *eol ? eol + 1 : eol;
+  }
+
+  return (found == 7) ? 0 : -1;
+}
+
+
+/* Parse /proc/loadavg: "0.20 0.18 0.12 1/80 11206". Return the PID
+   of the most recently created process. */
+int parse_loadavg(const char* buf, int* last_pid)
+{
+  const char* p = skip_fields(buf, 4);
+  unsigned long long val;
+
+  if (!read_ulong(p, &val))
+    return -1;
+  *last_pid = (int)val;
+  return 0;
+}
+
+
+/* Parse the "cpu" line of /proc/stat starting at 'buf':
+   "cpu3 user nice system idle iowait irq softirq ...". Return a
+   pointer to the next line, or NULL if 'buf' is not a cpu line (they
+   all come first in the file). */
+const char* parse_cpu_stat(const char* buf, struct cpu_stat* st)
+{
+  const char* p = buf;
+  unsigned long long t[7];
+  int i;
+
+  if (strncmp(p, "cpu", 3) != 0)
+    return NULL;
+  p += 3;
+  if (*p == ' ')
+    st->cpu = -1;
+  else {
+    unsigned long long val;
+    if (!(p = read_ulong(p, &val)))
+      return NULL;
+    st->cpu = (int)val;
+  }
+  while (*p == ' ')
+    p++;
+
+  for(i = 0; i < 7; i++) {
+    if (!(p = read_ulong(p, &t[i])))
+      return NULL;
+  }
+  st->user = t[0] + t[1];
+  st->system = t[2] + t[5] + t[6];
+
+  p = strchr(p, '\n');
+  return p ? p + 1 : NULL;
+}
+
+
+/* Parse /proc/uptime, uptime of the system in seconds. */
+int parse_uptime(const char* buf, double* uptime)
+{
+  char* end;
+
+  *uptime = strtod(buf, &end);
+  if (end == buf)
+    return -1;
+  return 0;
+}
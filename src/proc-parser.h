@@ -0,0 +1,42 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+#ifndef _PROC_PARSER_H
+#define _PROC_PARSER_H
+
+
+/* Fields of /proc/PID/task/TID/stat used by tiptop. */
+struct task_stat {
+  char state;                    /* field 3 */
+  unsigned long utime;           /* field 14 */
+  unsigned long stime;           /* field 15 */
+  unsigned long long starttime;  /* field 22 */
+  int processor;                 /* field 39, -1 if not available */
+};
+
+
+/* Times of a "cpu" line of /proc/stat, in clock ticks. */
+struct cpu_stat {
+  int cpu;                      /* CPU number, -1 for the summary line */
+  unsigned long long user;      /* user + nice */
+  unsigned long long system;    /* system + irq + softirq */
+};
+
+
+int read_proc_file(const char* path, char* buf, int size);
+
+int parse_stat(const char* buf, struct task_stat* st);
+int parse_status(const char* buf, char* name, int name_size,
+                 int* uid, int* num_threads);
+int parse_loadavg(const char* buf, int* last_pid);
+int parse_uptime(const char* buf, double* uptime);
+const char* parse_cpu_stat(const char* buf, struct cpu_stat* st);
+
+#endif  /* _PROC_PARSER_H */
@@ -11,71 +11,123 @@
 #include <assert.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <math.h>
 #include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "budget.h"
+#include "cgroup.h"
 #include "error.h"
 #include "hash.h"
 #include "options.h"
 #include "pmc.h"
 #include "priv.h"
+#include "proc-events.h"
+#include "proc-parser.h"
 #include "process.h"
 #include "screen.h"
 #include "spawn.h"
+#include "workers.h"
 
 static int num_files = 0;
 static int num_files_limit = 0;
+static int num_evicted = 0;  /* tasks whose counters were closed */
+static int rotation_files = 0;  /* reserved for the rotation, see rotate() */
+static int rotation_next = 0;   /* round-robin position among evicted tasks */
+
+/* at most that many evicted tasks get their counters back per refresh */
+#define MAX_REATTACH 16
+
+/* %CPU a task must gain over another to take its counters back. The
+   %CPU of lightly loaded tasks jumps by whole clock ticks, the
+   rotation serves them better than swapping at each refresh. */
+#define REATTACH_MARGIN 5.0
+
+/* upper bound of the files budget, even when the system allows more */
+#define MAX_FILES_LIMIT (1 << 24)
+
+/* once tasks are evicted, this fraction of the files (1/N) is reserved
+   to give them counters in turn */
+#define ROTATION_SHARE 8
+
+/* new tasks attached between two reports of progress */
+#define ATTACH_SLICE 256
+
+static attach_progress_t attach_progress = NULL;
 
 static int   clk_tck;
 
+static int inherit_supported(const struct option* const options);
+
 
 /*
  * Build the (empty) list of processes/threads.
  */
-struct process_list* init_proc_list()
+struct process_list* init_proc_list(const struct option* const options)
 {
   struct process_list* l;
-  char  name[100] = { 0 };  /* needs to fit the name /proc/xxxx/limits */
-  char  line[100];
-  FILE* f;
+  struct rlimit lim;
+  int   expected;
 
   clk_tck = sysconf(_SC_CLK_TCK);
 
+  /* the limit was raised at startup, see raise_files_limit */
+  num_files_limit = 0;
+  if (getrlimit(RLIMIT_NOFILE, &lim) == 0)
+    num_files_limit = (lim.rlim_cur > MAX_FILES_LIMIT) ?
+                                   MAX_FILES_LIMIT : (int)lim.rlim_cur;
+
+  num_files_limit -= 10; /* keep some slack */
+  if (num_files_limit <= 0)  /* something went wrong */
+    num_files_limit = 200;  /* reasonable default? */
+  num_files = 0;
+  num_evicted = 0;
+  rotation_files = num_files_limit / ROTATION_SHARE;
+  rotation_next = 0;
+
+  /* size the tables for the number of tasks the budget can hold, with
+     a few counters each */
+  expected = num_files_limit / 4;
+
   l = malloc(sizeof(struct process_list));
   l->processes = NULL;
-  l->num_alloc = 20;
+  l->num_alloc = (expected < 20) ? 20 : (expected > 4096) ? 4096 : expected;
   l->proc_ptrs = malloc(l->num_alloc * sizeof(struct process*));
   l->num_tids = 0;
   l->most_recent_pid = 0;
+  l->total = NULL;
+  /* when threads are hidden, count per process if the kernel can */
+  l->inherit = !options->show_threads && inherit_supported(options);
 
-  hash_init();
+  hash_init(expected);
+  known_init();
 
-  num_files_limit = 0;
-  snprintf(name, sizeof(name) - 1, "/proc/%d/limits", getpid());
-  f = fopen(name, "r");
-  if (f) {
-    while (fgets(line, 100, f)) {
-      int n;
-      n = sscanf(line, "Max open files %d", &num_files_limit);
-      if (n)
-        break;
-    }
-    fclose(f);
-  }
+  /* subscribe to process events, if possible (done only once) */
+  proc_events_init();
 
-  num_files_limit -= 10; /* keep some slack */
-  if (num_files_limit == 0)  /* something went wrong */
-    num_files_limit = 200;  /* reasonable default? */
-  num_files = 0;
+  budget_invalidate(l);
   return l;
 }
 
 
+/* Budget of files for the counters. Return the limit, and the number
+   of files in use in 'used' if not NULL. */
+int files_budget(int* used)
+{
+  if (used)
+    *used = num_files;
+  return num_files_limit;
+}
+
+
 /* Free memory for all fields of the process. */
 static void done_proc(struct process* const p)
 {
@@ -85,6 +137,7 @@ static void done_proc(struct process* const p)
     free(p->cmdline);
   free(p->name);
   free(p->txt);
+  free(p->history);
   if (p->username)
     free(p->username);
 
@@ -94,6 +147,15 @@ static void done_proc(struct process* const p)
       num_files--;
     }
   }
+  if (p->stat_fd != -1) {
+    close(p->stat_fd);
+    num_files--;
+  }
+  for(val_idx=0; val_idx < p->num_sets; val_idx++) {
+    close_files(p->sets[val_idx]);
+    free(p->sets[val_idx]);
+  }
+  free(p->sets);
 }
 
 
@@ -116,6 +178,9 @@ void done_proc_list(struct process_list* list)
   free(list->proc_ptrs);
   free(list);
   hash_fini();
+  known_fini();
+  done_cgroup_list();
+  budget_fini();
 }
 
 
@@ -157,556 +222,2067 @@ static char* get_cmdline(int pid, char* result, int size)
 
 
 
-void start_counters(struct process* ptr,
-                    const screen_t* const screen,
-                    struct STRUCT_NAME* events,
-                    const struct option* const options)
+/* Reserve a file for a counter, or another file that the counters
+   need (a cgroup directory...). Return 0 when the limit is reached.
+   The worker threads open counters concurrently (see start_batch). */
+int take_file(void)
 {
-  const int cpu = -1;
-  const int grp = -1;
-  const int flags = 0;
-  int zz;
+  if (__sync_add_and_fetch(&num_files, 1) <= num_files_limit)
+    return 1;
+  __sync_fetch_and_sub(&num_files, 1);
+  return 0;
+}
 
-  /* Get number of counters from screen */
-  ptr->num_events = screen->num_counters;
 
-  /* If we have reached the maximum number of open files, we try to
-     close the events attached to some idle processes (unless
-     forbidden to do so by command line flag). */
-  if ((num_files + ptr->num_events >= num_files_limit) &&
-      (!options->no_collect))
-  {
-    int num_collected = 0;
-    struct process* q = ptr->next;
-    while (q && (num_collected < ptr->num_events)) {
-      if ((!q->inactive) &&  /* inactive are not initialized yet */
-          (q->cpu_percent < options->cpu_threshold))
-      {
-        for(zz = 0; zz < q->num_events; zz++) {
-          if (q->fd[zz] >= 0) {
-            close(q->fd[zz]);
-            q->fd[zz] = -1;
-            q->values[zz] = 0xffffffff;
-            num_collected++;
-          }
-        }
-      }
-      q = q->next;
-    }
-    num_files -= num_collected;
-  }
+/* Give back a file reserved with take_file, once closed. */
+void release_file(void)
+{
+  __sync_fetch_and_sub(&num_files, 1);
+}
 
-  for(zz = 0; zz < ptr->num_events; zz++)
-    ptr->prev_values[zz] = 0;
 
-  /* restore super powers, if any, for the time of the system call */
-  restore_privilege();
-  for(zz = 0; zz < ptr->num_events; zz++) {
-    int fd;
-    events->type = screen->counters[zz].type;  /* eg PERF_TYPE_HARDWARE */
-    events->config = screen->counters[zz].config;
-
-    if (num_files < num_files_limit) {
-      fd = perf_event_open(events, ptr->tid, cpu, grp, flags);
-      if (fd == -1) {
-        error_printf("Could not attach counter '%s' to PID %d (%s): %s\n",
-                     screen->counters[zz].alias,
-                     ptr->tid,
-                     ptr->name,
-                     strerror(errno));
-      }
+/* Open counter 'zz' of the screen for 'ptr' (see open_counters).
+   With 'group', it joins the group of 'ptr', or leads it if there is
+   none yet. Otherwise, it is opened alone. */
+static void open_counter(struct process* ptr,
+                         const screen_t* const screen,
+                         struct STRUCT_NAME* events, int zz,
+                         pid_t pid, int cpu, unsigned long flags, int group)
+{
+  int fd;
+
+  events->type = screen->counters[zz].type;  /* eg PERF_TYPE_HARDWARE */
+  events->config = screen->counters[zz].config;
+
+  if (take_file()) {
+    if (!group)
+      fd = perf_event_open(events, pid, cpu, -1, flags);
+    else if (ptr->grp_leader == -1) {
+      fd = perf_event_open(events, pid, cpu, -1, flags);
+      if (fd != -1)
+        ptr->grp_leader = zz;
     }
     else {
-      fd = -1;
-      error_printf("Files limit reached for PID %d (%s)\n",
-                   ptr->tid, ptr->name);
+      fd = perf_event_open(events, pid, cpu,
+                           ptr->fd[ptr->grp_leader], flags);
+      if (fd != -1)
+        ptr->grp_members |= 1U << zz;
+      else
+        fd = perf_event_open(events, pid, cpu, -1, flags);
     }
-
-    if (fd != -1)
-      num_files++;
-    ptr->fd[zz] = fd;
-    ptr->values[zz] = 0;
+    if (fd == -1)
+      release_file();
+    if ((fd == -1) && ((pid == -1) || flags)) {
+      error_printf("Could not attach counter '%s' to %s on CPU %d: %s\n",
+                   screen->counters[zz].alias,
+                   (pid == -1) ? "all tasks" : ptr->name,
+                   cpu, strerror(errno));
+    }
+    else if (fd == -1) {
+      error_printf("Could not attach counter '%s' to PID %d (%s): %s\n",
+                   screen->counters[zz].alias,
+                   ptr->tid,
+                   ptr->name,
+                   strerror(errno));
+    }
+  }
+  else {
+    fd = -1;
+    error_printf("Files limit reached for %s %d (%s)\n",
+                 (cpu != -1) ? "CPU" : "PID",
+                 (cpu != -1) ? cpu : ptr->tid, ptr->name);
   }
 
-  /* drop super powers again */
-  drop_privilege();
+  ptr->fd[zz] = fd;
+  ptr->values[zz] = 0;
 }
 
 
-void new_processes(struct process_list* const list,
-                   const screen_t* const screen,
-                   const struct option* const options)
+/* Give back to the owner of threads its own values, replaced by the
+   totals of the process in accumulate_stats. */
+static void restore_own_values(struct process* const p)
 {
-  struct dirent*     pid_dirent;
-  DIR*               pid_dir;
-  int                num_tids, val, n, num_inactive, alloc_inact, i;
-  struct STRUCT_NAME events = {0, };
-  FILE*              f;
-  uid_t              my_uid = -1;
-  struct process**   inactive;
-
-  /* To avoid scanning the entire /proc directory, we first check if
-     any process has been created since last time. /proc/loadavg
-     contains the PID of the most recent process. We compare with our
-     own most recent. */
-  f = fopen("/proc/loadavg", "r");
-  n = fscanf(f, "%*f %*f %*f %*d/%*d %d", &val);
-  fclose(f);
-  /* if no new process has been created since last time, just quit. */
-  if ((n == 1) && (val == list->most_recent_pid))
+  if (!p->accumulated)
     return;
+  memcpy(p->values, p->own_values, p->num_events * sizeof(p->values[0]));
+  memcpy(p->prev_values, p->own_prev_values,
+         p->num_events * sizeof(p->prev_values[0]));
+  p->accumulated = 0;
+}
 
-  list->most_recent_pid = val;
 
-  num_tids = list->num_tids;
+/* Open the counters of the screen for 'ptr', monitoring task 'pid'
+   on any CPU, or everything running on CPU 'cpu' when 'pid' is -1.
+   With PERF_FLAG_PID_CGROUP in 'flags', 'pid' is the file descriptor
+   of a cgroup directory, and 'cpu' is mandatory. The caller restores
+   the privilege around it, on the main thread (see priv.c). */
+void open_counters(struct process* ptr,
+                   const screen_t* const screen,
+                   struct STRUCT_NAME* events,
+                   pid_t pid, int cpu, unsigned long flags)
+{
+  int zz;
 
-  events.disabled = 0;
-  events.pinned = 1;
-  events.exclude_hv = 1;
-  /* events.exclude_idle = 1; ?? */
-  if (options->show_kernel == 0)
-    events.exclude_kernel = 1;
+  restore_own_values(ptr);
+  for(zz = 0; zz < ptr->num_events; zz++) {
+    ptr->prev_values[zz] = 0;
+    ptr->raw[zz] = 0;
+    ptr->time_enabled[zz] = 0;
+    ptr->time_running[zz] = 0;
+  }
+  ptr->run_ratio = -1;
 
-  num_inactive = 0;
-  alloc_inact = 100;
-  inactive = malloc(alloc_inact * sizeof(struct process*));
+  /* The first counter successfully opened leads a group, the next ones
+     are attached to it: they are scheduled together on the PMU, and
+     read all at once (see read_counters). A counter that the kernel
+     refuses in the group (too many for the hardware...) is opened
+     alone, as its own group of one. */
+  ptr->grp_leader = -1;
+  ptr->grp_members = 0;
 
-  /* check all directories of /proc */
-  pid_dir = opendir("/proc");
-  while ((pid_dirent = readdir(pid_dir))) {
-    int   uid, pid, num_threads, req_info;
-    char  name[50] = { 0 }; /* needs to fit /proc/xxxx/{status,cmdline} */
-    char  line[100]; /* line of /proc/xxxx/status */
-    char  proc_name[100];
-    int   skip_by_pid, skip_by_user;
-    char  cmdline[100];
+  for(zz = 0; zz < ptr->num_events; zz++)
+    open_counter(ptr, screen, events, zz, pid, cpu, flags, 1);
+}
 
-    if (pid_dirent->d_type != DT_DIR)  /* not a directory */
-      continue;
 
-    if ((pid = atoi(pid_dirent->d_name)) == 0)  /* not a number */
-      continue;
+/* A counter set that is not a row: a thread of a process in process
+   mode, a cgroup on a CPU... 'name' is only used in error messages. */
+struct process* new_counter_set(int tid, const char* name, int num_events)
+{
+  struct process* set = calloc(1, sizeof(struct process));
+
+  set->tid = set->pid = tid;
+  set->name = (char*)name;
+  set->stat_fd = -1;
+  set->grp_leader = -1;
+  set->num_events = num_events;
+  return set;
+}
 
-    snprintf(name, sizeof(name) - 1, "/proc/%d/status", pid);
-    f = fopen(name, "r");
-    if (!f)
-      continue;
 
-    /* collect basic information about process */
-    req_info = 3;  /* need 3 pieces of information */
-    while (fgets(line, sizeof(line), f) && req_info) {
-      /* read the name now, since we will encounter it before Uid anyway */
-      if (strncmp(line, "Name:", 5) == 0) {
-        sscanf(line, "%*s %s", proc_name);
-        req_info--;
-      }
-      if (strncmp(line, "Uid:", 4) == 0) {
-        sscanf(line, "%*s %d", &uid);
-        req_info--;
-      }
-      if (strncmp(line, "Threads:", 8) == 0) {
-        sscanf(line, "%*s %d", &num_threads);
-        req_info--;
-      }
-    }
-    fclose(f);
+/* Can the counters follow the threads of a process, and only them
+   (inherit_thread, Linux 5.13)? Plain inheritance would also count
+   the child processes, which have rows of their own. */
+static int inherit_supported(const struct option* const options)
+{
+  static int supported = -1;
+#ifdef PERF_ATTR_SIZE_VER7
+  struct STRUCT_NAME events;
+  int fd;
 
-    if (req_info != 0) {  /* could not read all 3 info. Process is gone? */
-      error_printf("Could not read info for process %d (gone already?)\n", pid);
-      continue;
-    }
+  if (supported != -1)
+    return supported;
 
-    cmdline[0] = '\0';
-    skip_by_pid = 0;
-    /* if "only" filter is set */
-    if (options->only_pid && (pid != options->only_pid))
-      skip_by_pid = 1;
+  init_events_attr(&events, options);
+  events.type = PERF_TYPE_SOFTWARE;
+  events.config = PERF_COUNT_SW_TASK_CLOCK;
+  events.inherit = 1;
+  events.inherit_thread = 1;
 
-    if (options->only_name) {
-      if (options->show_cmdline) {  /* show_cmdline is on */
-        get_cmdline(pid, cmdline, sizeof(cmdline));
-        if (strstr(cmdline, options->only_name) == NULL) {
-          skip_by_pid = 1;
-        }
-      }
-      else {  /* show_cmdline is off */
-        if (strstr(proc_name, options->only_name) == NULL)
-          skip_by_pid = 1;
-      }
-    }
+  restore_privilege();
+  fd = perf_event_open(&events, 0, -1, -1, 0);
+  drop_privilege();
 
-    /* All processes if I am root, only mine if I am not root. */
-    skip_by_user = 0;
-    my_uid = options->euid;
-    if ((my_uid != 0) && (uid != my_uid)) /* not root, can monitor only mine */
-      skip_by_user = 1;
+  supported = (fd != -1);
+  if (fd != -1)
+    close(fd);
+#else
+  supported = 0;
+#endif
+  return supported;
+}
 
-    if ((skip_by_user == 0) && (skip_by_pid == 0)) {
-      DIR* thr_dir;
-      struct dirent* thr_dirent;
-      int  tid;
-      char task_name[50] = { 0 };
 
-      snprintf(task_name, sizeof(task_name) - 1, "/proc/%d/task", pid);
-      thr_dir = opendir(task_name);
-      if (!thr_dir)  /* died just now? Will be marked dead at next iteration. */
-        continue;
+/* Process mode: open one set of inherited counters on each thread
+   that exists now. The threads created later are counted by the set of
+   their creator, without any new file. */
+static void open_inherited(struct process* ptr,
+                           const screen_t* const screen,
+                           struct STRUCT_NAME* events)
+{
+#ifdef PERF_ATTR_SIZE_VER7
+  struct STRUCT_NAME inherited = *events;
+  struct dirent* thr_dirent;
+  char  task_name[50] = { 0 };
+  DIR*  thr_dir;
+  int   zz;
 
-      /* Iterate over all threads in the process */
-      while ((thr_dirent = readdir(thr_dir))) {
-        struct process* ptr;
-        struct passwd*  passwd;
+  inherited.inherit = 1;
+  inherited.inherit_thread = 1;
 
-        tid = atoi(thr_dirent->d_name);
-        if (tid == 0)
-          continue;
+  /* the row itself has no file, its values are the sum of the sets */
+  for(zz = 0; zz < ptr->num_events; zz++) {
+    ptr->fd[zz] = -1;
+    ptr->values[zz] = 0;
+    ptr->prev_values[zz] = 0;
+  }
 
-        ptr = hash_get(tid);
-        if (ptr)  /* already known */
-          continue;
+  /* main thread first: threads it creates from now on are covered */
+  ptr->sets = malloc(sizeof(struct process*));
+  ptr->sets[0] = new_counter_set(ptr->pid, ptr->name, ptr->num_events);
+  ptr->num_sets = 1;
+  open_counters(ptr->sets[0], screen, &inherited, ptr->pid, -1, 0);
 
-        /* We have a new thread. */
+  snprintf(task_name, sizeof(task_name) - 1, "/proc/%d/task", ptr->pid);
+  thr_dir = opendir(task_name);
+  if (!thr_dir)
+    return;
+  while ((thr_dirent = readdir(thr_dir))) {
+    struct process* set;
+    int tid = atoi(thr_dirent->d_name);
+    if ((tid == 0) || (tid == ptr->pid))
+      continue;
+    set = new_counter_set(tid, ptr->name, ptr->num_events);
+    open_counters(set, screen, &inherited, tid, -1, 0);
+    ptr->sets = realloc(ptr->sets, (ptr->num_sets + 1) * sizeof(*ptr->sets));
+    ptr->sets[ptr->num_sets++] = set;
+  }
+  closedir(thr_dir);
+#endif
+}
 
-        /* allocate memory */
-        ptr = malloc(sizeof(struct process));
 
-        /* insert into list of processes */
-        /* Insert at the front of the list. This will later let us
-           scan the rest of the list when looking for idle processes,
-           closing files. */
-        ptr->next = list->processes;
-        list->processes = ptr;
+/* Number of files the counters of 'ptr' need. In process mode, a
+   set per thread. */
+static int files_needed(const struct process* const ptr)
+{
+  if (ptr->inherit && (ptr->num_threads > 1))
+    return ptr->num_events * ptr->num_threads;
+  return ptr->num_events;
+}
 
-        /* update helper data structures */
-        if (num_tids == list->num_alloc) {
-          list->num_alloc += 20;
-          list->proc_ptrs = realloc(list->proc_ptrs,
-                                    list->num_alloc*sizeof(struct process));
-        }
-        list->proc_ptrs[num_tids] = ptr;
-        hash_add(tid, ptr);
-
-        /* fill in information for new process */
-        ptr->tid = tid;
-        ptr->pid = pid;
-        ptr->proc_id = -1;
-        ptr->dead = 0;
-        ptr->inactive = 0;
-        ptr->u.d = 0.0;
-
-        passwd = getpwuid(uid);
-        if (passwd)
-          ptr->username = strdup(passwd->pw_name);
-        else
-          ptr->username = NULL;
-
-        ptr->num_threads = (short)num_threads;
-        if (cmdline[0] == '\0')
-          get_cmdline(pid, cmdline, sizeof(cmdline));
-        ptr->cmdline = strdup(cmdline);
-        ptr->name = strdup(proc_name);
-        struct timeval now;
-        gettimeofday(&now, NULL);
-        ptr->timestamp = now;
-        ptr->prev_cpu_time_s = 0;
-        ptr->prev_cpu_time_u = 0;
-
-        /* initialize at 100 to avoid immediate collection as inactive */
-        ptr->cpu_percent =   100.0;
-        ptr->cpu_percent_s =   0.0;
-        ptr->cpu_percent_u = 100.0;
-
-        float uptime;
-        f = fopen("/proc/uptime", "r");
-        n = fscanf(f, "%f", &uptime);
-        fclose(f);
-        uptime *= clk_tck;
-
-        /* read utime, stime and starttime (fields 14, 15, and 22) */
-        snprintf(name, sizeof(name) - 1, "/proc/%d/stat", tid);
-        f = fopen(name, "r");
-        if (!f)
-          continue;
-        unsigned long utime, stime;
-        unsigned long long starttime;
-        n = fscanf(f, "%*d (%*[^)]) %*c %*d %*d %*d %*d %*d %*u %*u "
-                   "%*u %*u %*u %lu %lu %*d %*d %*d %*d %*d %*d %llu",
-                   &utime, &stime, &starttime);
-        fclose(f);
-
-        /* Due to the limited number of files in a Linux process (each
-           counter corresponds to a file), we want to start counters
-           first for active process. Idle processes are
-           postponed. This increases the chances to display useful
-           information: a dash only for idle processes. */
-        if ((utime + stime)/(uptime - starttime) > 0.3) {
-          /* active process: %CPU > 30% */
-          start_counters(ptr, screen, &events, options);
-        }
-        else {
-          /* less active: postpone. Add to a list of inactive
-             processes, to be handled later. */
-          inactive[num_inactive++] = ptr;
-          /* Mark so that the collection of quasi-idle processes phase
-             will skip. Most data structures are not initialized
-             yet. */
-          ptr->inactive = 1;
-          if (num_inactive == alloc_inact) {
-            alloc_inact += 100;
-            inactive = realloc(inactive, alloc_inact * sizeof(struct process*));
-          }
-        }
 
-        ptr->txt = malloc(TXT_LEN * sizeof(char));
+/* Close all the files of a task, and forget the counter sets of
+   process mode. Its stat file will be opened on demand from now on. */
+static void release_counters(struct process* const q)
+{
+  int zz;
 
-        list->num_tids++;  /* insert in any case */
-        num_tids++;
-      }
-      closedir(thr_dir);
-    }
-  }
+  close_files(q);
+  for(zz = 0; zz < q->num_sets; zz++)
+    free(q->sets[zz]);
+  free(q->sets);
+  q->sets = NULL;
+  q->num_sets = 0;
+}
 
-  /* handle inactive processes */
-  for(i=0; i < num_inactive; i++) {
-    start_counters(inactive[i], screen, &events, options);
-    inactive[i]->inactive = 0;
-  }
-  free(inactive);
 
-  closedir(pid_dir);
+/* Close the counters of a task to save files. */
+static void evict(struct process* const q)
+{
+  int zz;
+
+  restore_own_values(q);
+  for(zz = 0; zz < q->num_events; zz++)
+    q->values[zz] = 0xffffffff;  /* use marker */
+  release_counters(q);
+  q->evicted = 1;
+  num_evicted++;
 }
 
 
-/*
- * Update all processes in the list with newly collected statistics.
- * Return the number of dead processes.
- */
-int update_proc_list(struct process_list* const list,
-                     const screen_t* const screen,
-                     struct option* const options)
+/* Files available to the tasks that keep their counters. */
+static int files_limit(void)
 {
-  struct process* proc;
-  int    num_dead = 0;
+  return num_evicted ? num_files_limit - rotation_files : num_files_limit;
+}
 
-  assert(screen);
-  assert(list && list->proc_ptrs);
 
-  /* add newly created processes/threads */
-  new_processes(list, screen, options);
+/* Evict the least active tasks, below 'below' %CPU, until 'needed'
+   files are available. Return 1 if there is enough room. */
+static int make_room(int needed, double below,
+                     const struct option* const options)
+{
+  while (num_files + needed >= files_limit()) {
+    struct process* q;
+
+    if (options->no_collect)
+      return 0;
+    q = budget_coldest(options);
+    if (!q || (q->cpu_percent >= below))
+      return 0;
+    budget_pop_coldest();
+    evict(q);
+  }
+  return 1;
+}
 
-  /* update statistics */
-  for(proc = list->processes; proc; proc = proc->next) {
-    FILE*     fstat;
-    char      sub_task_name[100] = { 0 };
-    double    elapsed;
-    unsigned long   utime = 0, stime = 0;
-    unsigned long   prev_cpu_time, curr_cpu_time;
-    int             proc_id, zz, zombie;
-    struct timeval  now;
-
-    if (proc->dead) {
-      num_dead++;
-      continue;
-    }
 
-    /* Compute %CPU, retrieve processor ID. */
-    snprintf(sub_task_name, sizeof(sub_task_name) - 1,
-             "/proc/%d/task/%d/stat", proc->pid, proc->tid);
-    fstat = fopen(sub_task_name, "r");
+/* Open the counters of 'ptr', in a single task or in a set per
+   thread. Safe to call from the worker threads. */
+static void open_task(struct process* ptr,
+                      const screen_t* const screen,
+                      struct STRUCT_NAME* events)
+{
+  if (ptr->inherit)
+    open_inherited(ptr, screen, events);
+  else
+    open_counters(ptr, screen, events, ptr->tid, -1, 0);
+}
 
-    if (!fstat) {  /* this task disappeared */
-      num_dead++;
-      proc->dead = 1;  /* mark dead */
-      for(zz=0; zz < proc->num_events; ++zz) {
-        if (proc->fd[zz] != -1) {
-          close(proc->fd[zz]);
-          num_files--;
-          proc->fd[zz] = -1;
-        }
-      }
-      continue;
-    }
 
-    zombie = 0;
-    assert(fstat);
+/* When the files limit prevented all the counters of 'ptr', the task
+   is considered evicted, and gets another chance later. */
+static void check_opened(struct process* ptr)
+{
+  if (!ptr->evicted && !has_counters(ptr) &&
+      (num_files + files_needed(ptr) >= num_files_limit))
+    evict(ptr);
+}
 
-    int n;
-    char state;
-    n = fscanf(fstat,
-           "%*d (%*[^)]) %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
-           &state, &utime, &stime);
-    if (n != 3)
-      utime = stime = 0;
 
-    if (state == 'Z') {  /* zombie */
-      zombie = 1;
-    }
+/* Open the counters of 'ptr'. */
+static void attach(struct process* ptr,
+                   const screen_t* const screen,
+                   struct STRUCT_NAME* events)
+{
+  /* restore super powers, if any, for the time of the system calls */
+  restore_privilege();
+  open_task(ptr, screen, events);
+  drop_privilege();
+  check_opened(ptr);
+}
 
-    /* get processor ID */
-    n = fscanf(fstat,
-               "%*d %*d %*d %*d %*d %*d %*d %*u %*d %*u %*u %*u %*u "
-               "%*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %d",
-               &proc_id);
-    if (n != 1)
-      proc_id = -1;
-    fclose(fstat);
 
-    if (!zombie) {
-      /* do not update these values for a zombie, they have become invalid */
-      gettimeofday(&now, NULL);
-      elapsed = (now.tv_sec - proc->timestamp.tv_sec) +
-        (now.tv_usec - proc->timestamp.tv_usec)/1000000.0;
-      elapsed *= clk_tck;
+/* Decide whether task 'ptr' gets the 'needed' files of its new
+   counters, while 'pending' files are already promised to other
+   tasks. Return 0 if it is evicted right away. */
+static int admit(struct process* ptr, int needed, int pending,
+                 const struct option* const options)
+{
+  /* If we have reached the maximum number of open files, close the
+     counters of the least active tasks (unless forbidden to do so by
+     command line flag). Only idle tasks give way to a new one, which
+     has no history yet, except for the tasks the user asked for. */
+  if (!make_room(pending + needed,
+                 budget_pinned(ptr, options) ?
+                               HUGE_VAL : options->cpu_threshold,
+                 options) &&
+      num_evicted && !budget_pinned(ptr, options)) {
+    /* the remaining files are for the rotation, wait for a turn */
+    evict(ptr);
+    return 0;
+  }
+  if (num_files + pending >= num_files_limit) {  /* no file left at all */
+    evict(ptr);
+    return 0;
+  }
+  return 1;
+}
 
-      proc->timestamp = now;
 
-      prev_cpu_time = proc->prev_cpu_time_s + proc->prev_cpu_time_u;
-      curr_cpu_time = stime + utime;
-      proc->cpu_percent = 100.0*(curr_cpu_time - prev_cpu_time)/elapsed;
-      proc->cpu_percent_s = 100.0*(stime - proc->prev_cpu_time_s)/elapsed;
-      proc->cpu_percent_u = 100.0*(utime - proc->prev_cpu_time_u)/elapsed;
+void start_counters(struct process* ptr,
+                    const screen_t* const screen,
+                    struct STRUCT_NAME* events,
+                    const struct option* const options)
+{
+  /* Get number of counters from screen */
+  ptr->num_events = screen->num_counters;
+  if (admit(ptr, files_needed(ptr), 0, options))
+    attach(ptr, screen, events);
+}
 
-      proc->prev_cpu_time_s = stime;
-      proc->prev_cpu_time_u = utime;
-    }
 
-    proc->proc_id = (short)proc_id;
-    /* Backup previous value of counters */
-    for(zz = 0; zz < proc->num_events; zz++)
-      proc->prev_values[zz] = proc->values[zz];
+/* Highest slot of the group of 'p', or -1 if there is no group. */
+static int group_end(const struct process* const p)
+{
+  int zz;
 
-    /* Read performance counters */
-    for(zz = 0; zz < proc->num_events; zz++) {
-      uint64_t value = 0;
-      int r;
-      /* When fd is -1, the syscall failed on that counter */
-      if (proc->fd[zz] != -1) {
-        r = read(proc->fd[zz], &value, sizeof(value));
-        if (r == sizeof(value))
-          proc->values[zz] = value;
-        else
-          proc->values[zz] = 0;
-      }
-      else  /* no fd, use marker */
-        proc->values[zz] = 0xffffffff;
-    }
-    if (zombie) {
-      proc->dead = 1;
-      wait_for_child(proc->tid, options);
-    }
+  for(zz = p->num_events - 1; zz > p->grp_leader; zz--) {
+    if (p->grp_members & (1U << zz))
+      return zz;
   }
-
-  return num_dead;
+  return p->grp_leader;
 }
 
 
-/* Scan list of processes and deallocates the dead ones, compacting the list. */
-void compact_proc_list(struct process_list* const list)
+/* Open the counters of the closed slots of 'p', after a change of
+   screen (see remap_slots). A counter can only join the group after
+   its last member: the kernel reads the members in the order they
+   joined. Safe to call from the worker threads. */
+static void open_slots(struct process* p,
+                       const screen_t* const screen,
+                       struct STRUCT_NAME* events)
 {
-  struct process* p;
-  int i;
+  int zz;
 
-  for(p = list->processes; p; p = p->next) {
-    if (p && p->next && p->next->dead) {
-      struct process* to_delete = p->next;
-      hash_del(to_delete->tid);
-      p->next = to_delete->next;
-      done_proc(to_delete);
-      free(to_delete);
-      list->num_tids--;
-    }
-  }
-  /* special case for 1st element */
-  if (list->processes->dead) {
-    struct process* to_delete = list->processes;
-    hash_del(to_delete->tid);
-    list->processes = to_delete->next;
-    done_proc(to_delete);
-    free(to_delete);
-    list->num_tids--;
+  if (p->evicted)  /* made room for another task in the meantime */
+    return;
+  if (p->inherit) {  /* counter sets released, start over */
+    open_task(p, screen, events);
+    return;
   }
+  for(zz = 0; zz < p->num_events; zz++) {
+    if (p->fd[zz] == -1)
+      open_counter(p, screen, events, zz, p->tid, -1, 0,
+                   (p->grp_leader == -1) || (zz > group_end(p)));
+  }
+}
 
-  /* update pointers */
-  i = 0;
-  for(p = list->processes; p; p = p->next) {
-    list->proc_ptrs[i] = p;
-    i++;
+
+/* Tasks whose counters are opened by the worker threads: new tasks,
+   or all the tasks after a change of screen. */
+struct attach_batch {
+  struct process**          tasks;
+  const screen_t*           screen;
+  const struct STRUCT_NAME* events;
+  int                       switching;  /* open_slots rather than open_task */
+};
+
+
+static void attach_tasks(void* arg, int first, int last)
+{
+  const struct attach_batch* const batch = arg;
+  struct STRUCT_NAME events = *batch->events;  /* changed by open_counters */
+  int i;
+
+  for(i = first; i < last; i++) {
+    if (batch->switching)
+      open_slots(batch->tasks[i], batch->screen, &events);
+    else
+      open_task(batch->tasks[i], batch->screen, &events);
   }
 }
 
 
-/*
- * When threads are not displayed, this function accumulates
- * per-thread statistics in the parent process (which is also a
- * thread).
- */
-void accumulate_stats(const struct process_list* const list)
+void set_attach_progress(attach_progress_t fun)
 {
-  int zz;
-  struct process* p;
+  attach_progress = fun;
+}
 
-  p = list->processes;
-  for(p = list->processes; p; p = p->next) {
-    if (p->pid != p->tid) {
-      struct process* owner;
 
-      if (p->dead)
-        continue;
+/* Run the system calls of the 'num' tasks of 'tasks' on the worker
+   threads, with the privilege restored once for all of them. */
+static void run_batch(struct attach_batch* batch,
+                      struct process** tasks, int num)
+{
+  int done;
 
-      /* find the owner */
-      owner = hash_get(p->pid);
-      assert(owner);
+  restore_privilege();
+  for(done = 0; done < num; done += ATTACH_SLICE) {
+    const int size = (num - done < ATTACH_SLICE) ? num - done : ATTACH_SLICE;
 
-      /* accumulate in owner process */
-      owner->cpu_percent += p->cpu_percent;
-      for(zz = 0; zz < p->num_events; zz++) {
-        /* as soon as one thread has an invalid value, mark the owner
-           as invalid as well (cannot compute a correct value) */
-        if (p->values[zz] == 0xffffffff)
-          owner->values[zz] = 0xffffffff;
-        else
-          owner->values[zz] += p->values[zz];
-      }
-    }
+    batch->tasks = tasks + done;
+    workers_run(attach_tasks, batch, size);
+    if (attach_progress && (num > ATTACH_SLICE))
+      attach_progress(done + size, num);
   }
+  drop_privilege();
 }
 
 
-/*
- * When switching back from show_threads to no_thread, we need to
- * reset the statistics of the parent thread, because they contain
- * accumulated values, much higher than per-thread value. Failing to
- * do so results in transient erratic displayed values.
- */
-void reset_values(const struct process_list* const list)
+/* Start the counters of the 'num' new tasks of 'tasks', by order of
+   priority. After the first scan of a large system, this is tens of
+   thousands of perf_event_open calls: the decisions (which task gets
+   counters, which ones are evicted) are taken here, then the system
+   calls are spread over the worker threads. 'tasks' is reordered. */
+static void start_batch(struct process** tasks, int num,
+                        const screen_t* const screen,
+                        const struct STRUCT_NAME* events,
+                        const struct option* const options)
 {
-  struct process* p;
-
-  for(p = list->processes; p; p = p->next) {
-    if (p->dead)
+  struct attach_batch batch;
+  int i, n, pending;
+
+  n = 0;
+  pending = 0;
+  for(i = 0; i < num; i++) {
+    tasks[i]->num_events = screen->num_counters;
+    if (!admit(tasks[i], files_needed(tasks[i]), pending, options))
       continue;
-    /* only consider 'main' processes (not threads) */
-    if (p->pid == p->tid) {
-      int zz;
-      p->cpu_percent = 0;
-      for(zz = 0; zz < p->num_events; zz++) {
-        p->values[zz] = 0;
-      }
-    }
+    pending += files_needed(tasks[i]);
+    tasks[n++] = tasks[i];
   }
-}
 
+  batch.screen = screen;
+  batch.events = events;
+  batch.switching = 0;
+  run_batch(&batch, tasks, n);
 
-/* This is only used when tiptop fires a command itself. Right after
-   the fork, the process name and command line are tiptop's. They are
-   correct after exec. update_name_cmdline is invoked a little while
-   after exec to fix these fields. */
+  for(i = 0; i < n; i++)
+    check_opened(tasks[i]);
+}
+
+
+/* Index in 'old' of each counter of 'screen', or -1 when it is not
+   counted by 'old'. */
+static void map_counters(const counter_t* const old, int num_old,
+                         const screen_t* const screen, int* map)
+{
+  unsigned int taken = 0;
+  int i, zz;
+
+  for(zz = 0; zz < screen->num_counters; zz++) {
+    map[zz] = -1;
+    for(i = 0; i < num_old; i++) {
+      if (!(taken & (1U << i)) &&
+          (old[i].type == screen->counters[zz].type) &&
+          (old[i].config == screen->counters[zz].config)) {
+        map[zz] = i;
+        taken |= 1U << i;
+        break;
+      }
+    }
+  }
+}
+
+
+/* Move the counters of 'p' to their slots in the new screen, as given
+   by 'map', with their history, and close those that the new screen
+   does not use. The slots of the new counters are left closed.
+
+   The kernel reads the members of a group in the order they joined,
+   which must remain the order of the slots: a member that would move
+   before another one is closed (and opened again later). When the
+   leader is closed, the kernel turns each member into a group of its
+   own. */
+static void remap_slots(struct process* const p, const int* map,
+                        int num_events)
+{
+  int      inv[MAX_EVENTS];  /* new slot of each old slot, or -1 */
+  int      fd[MAX_EVENTS];
+  uint64_t values[MAX_EVENTS], prev_values[MAX_EVENTS], raw[MAX_EVENTS];
+  uint64_t time_enabled[MAX_EVENTS], time_running[MAX_EVENTS];
+  double   rate[MAX_EVENTS];
+  unsigned int members = 0;
+  int      leader = -1, last, zz;
+
+  restore_own_values(p);
+  for(zz = 0; zz < MAX_EVENTS; zz++)
+    inv[zz] = -1;
+  for(zz = 0; zz < num_events; zz++) {
+    if ((map[zz] != -1) && (map[zz] < p->num_events))
+      inv[map[zz]] = zz;
+  }
+
+  if ((p->grp_leader != -1) && (inv[p->grp_leader] != -1)) {
+    leader = last = inv[p->grp_leader];
+    for(zz = p->grp_leader + 1; zz < p->num_events; zz++) {
+      if (!(p->grp_members & (1U << zz)) || (inv[zz] == -1))
+        continue;
+      if (inv[zz] < last)  /* out of order */
+        inv[zz] = -1;
+      else {
+        last = inv[zz];
+        members |= 1U << last;
+      }
+    }
+  }
+
+  for(zz = 0; zz < p->num_events; zz++) {
+    if ((inv[zz] == -1) && (p->fd[zz] != -1)) {
+      close(p->fd[zz]);
+      num_files--;
+    }
+  }
+
+  for(zz = 0; zz < num_events; zz++) {
+    const int old = map[zz];
+
+    if ((old != -1) && (inv[old] == zz)) {
+      fd[zz] = p->fd[old];
+      values[zz] = p->values[old];
+      prev_values[zz] = p->prev_values[old];
+      raw[zz] = p->raw[old];
+      time_enabled[zz] = p->time_enabled[old];
+      time_running[zz] = p->time_running[old];
+      rate[zz] = p->rate[old];
+    }
+    else {  /* new counter, nothing counted yet */
+      fd[zz] = -1;
+      values[zz] = (p->dead || p->evicted) ? 0xffffffff : 0;
+      prev_values[zz] = values[zz];
+      raw[zz] = 0;
+      time_enabled[zz] = 0;
+      time_running[zz] = 0;
+      rate[zz] = -1;
+    }
+  }
+
+  p->num_events = num_events;
+  memcpy(p->fd, fd, num_events * sizeof(fd[0]));
+  memcpy(p->values, values, num_events * sizeof(values[0]));
+  memcpy(p->prev_values, prev_values, num_events * sizeof(prev_values[0]));
+  memcpy(p->raw, raw, num_events * sizeof(raw[0]));
+  memcpy(p->time_enabled, time_enabled, num_events * sizeof(time_enabled[0]));
+  memcpy(p->time_running, time_running, num_events * sizeof(time_running[0]));
+  memcpy(p->rate, rate, num_events * sizeof(rate[0]));
+  p->grp_leader = leader;
+  p->grp_members = members;
+}
+
+
+/* Number of slots of 'p' without a counter. */
+static int closed_slots(const struct process* const p)
+{
+  int n = 0, zz;
+
+  for(zz = 0; zz < p->num_events; zz++) {
+    if (p->fd[zz] == -1)
+      n++;
+  }
+  return n;
+}
+
+
+/* Remap task 'p' to the counters of the new screen. Return the number
+   of files its new counters need. In process mode, the new counters
+   must also count the threads created since the sets were opened,
+   which only a new set of counters on each thread does. */
+static int remap_task(struct process* const p, const int* map,
+                      int num_events)
+{
+  int zz, missing = 0;
+
+  if (p->rotating) {  /* its turn ends now */
+    release_counters(p);
+    p->rotating = 0;
+  }
+  remap_slots(p, map, num_events);
+  for(zz = 0; zz < p->num_sets; zz++) {
+    remap_slots(p->sets[zz], map, num_events);
+    missing += closed_slots(p->sets[zz]);
+  }
+  if (p->dead || p->evicted)
+    return 0;
+
+  if (!p->inherit)
+    return closed_slots(p);
+  if (!missing && p->num_sets)
+    return 0;
+  release_counters(p);
+  p->fresh = 1;
+  return files_needed(p);
+}
+
+
+/* Can the tasks of 'list' not follow a change of counters? */
+static int must_rebuild(const struct process_list* const list,
+                        const struct option* const options)
+{
+  return options->per_cpu || options->cgroup_dir ||
+         (list->inherit != (!options->show_threads &&
+                            inherit_supported(options)));
+}
+
+
+/* The counters of the screen changed: they were 'old' (only their type
+   and config matter), they are now those of 'screen'. The tasks are
+   kept: the counters found in both (same type and config) remain
+   open, with their history, and only the new ones are opened, by the
+   worker threads. Return -1 if the list must be built again instead:
+   when the rows change between threads and processes, or in the
+   system-wide and cgroup modes, whose few rows are cheap to
+   rebuild. */
+int change_counters(struct process_list* const list,
+                    const counter_t* const old, int num_old,
+                    const screen_t* const screen,
+                    const struct option* const options)
+{
+  struct attach_batch batch;
+  struct STRUCT_NAME  events;
+  struct process**    tasks;
+  int                 map[MAX_EVENTS];
+  int                 i, n, pending;
+
+  if (must_rebuild(list, options))
+    return -1;
+
+  /* the heaps of the budget may date back to the previous refresh */
+  budget_invalidate(list);
+  map_counters(old, num_old, screen, map);
+  tasks = malloc((list->num_tids + 1) * sizeof(struct process*));
+  n = 0;
+  pending = 0;
+  for(i = 0; i < list->num_tids; i++) {
+    struct process* const p = list->proc_ptrs[i];
+    const int needed = remap_task(p, map, screen->num_counters);
+
+    if (!needed || !admit(p, needed, pending, options))
+      continue;
+    pending += needed;
+    tasks[n++] = p;
+  }
+
+  init_events_attr(&events, options);
+  batch.screen = screen;
+  batch.events = &events;
+  batch.switching = 1;
+  run_batch(&batch, tasks, n);
+
+  for(i = 0; i < n; i++)
+    check_opened(tasks[i]);
+  free(tasks);
+  budget_invalidate(list);
+  return 0;
+}
+
+
+/* The screen changes from 'old' to 'screen', see change_counters. All
+   the counters are opened again when 'old' is NULL (the kernel mode
+   changed...). */
+int switch_counters(struct process_list* const list,
+                    const screen_t* const old,
+                    const screen_t* const screen,
+                    const struct option* const options)
+{
+  if (must_rebuild(list, options))
+    return -1;
+  if (old == screen)
+    return 0;
+  return change_counters(list, old ? old->counters : NULL,
+                         old ? old->num_counters : 0, screen, options);
+}
+
+
+/* Forget which processes were filtered out: the filters changed, and
+   the next refresh scans /proc again. The tasks already monitored
+   are kept, with their counters. */
+void rescan_proc_list(struct process_list* const list)
+{
+  list->most_recent_pid = 0;
+  known_fini();
+  known_init();
+}
+
+
+/* Give their counters back to the evicted tasks that became active,
+   most active first. When files are missing, they are taken from the
+   tasks that are much less active (less than half, and by a margin),
+   so that two tasks of similar activity do not keep swapping. */
+static void reattach(const screen_t* const screen,
+                     const struct option* const options)
+{
+  struct STRUCT_NAME events;
+  struct process*    hot;
+  double             below;
+  int                n = 0;
+
+  if (num_evicted == 0)
+    return;
+
+  init_events_attr(&events, options);
+  while ((n < MAX_REATTACH) && (hot = budget_hottest(options))) {
+    const int pinned = budget_pinned(hot, options);
+
+    if (!pinned && (hot->cpu_percent < options->cpu_threshold))
+      break;  /* all the others are idle too */
+    budget_pop_hottest();
+    if (hot->rotating) {  /* in its slice, simply keep the counters */
+      hot->rotating = 0;
+      hot->evicted = 0;
+      num_evicted--;
+      n++;
+      continue;
+    }
+    below = hot->cpu_percent - REATTACH_MARGIN;
+    if (below > hot->cpu_percent / 2)
+      below = hot->cpu_percent / 2;
+    if (pinned)
+      below = HUGE_VAL;
+    if (!make_room(files_needed(hot), below, options))
+      break;  /* the next ones are less active, no better chance */
+
+    hot->evicted = 0;
+    num_evicted--;
+    attach(hot, screen, &events);
+    n++;
+  }
+}
+
+
+/* Basic information about a process, collected from /proc/PID/status
+   (and /proc/PID/cmdline when needed). */
+struct proc_info {
+  int  uid;
+  int  num_threads;
+  char name[100];
+  char cmdline[100];  /* empty string until read */
+};
+
+
+/* Read name, uid and number of threads of a process. Return 0 on
+   success, -1 if the process is gone. */
+static int read_proc_info(int pid, struct proc_info* info)
+{
+  char name[50] = { 0 }; /* needs to fit /proc/xxxx/status */
+  char buf[STATUS_BUF_LEN];
+
+  snprintf(name, sizeof(name) - 1, "/proc/%d/status", pid);
+  if (read_proc_file(name, buf, sizeof(buf)) == -1)
+    return -1;
+
+  /* collect basic information about process */
+  if (parse_status(buf, info->name, sizeof(info->name),
+                   &info->uid, &info->num_threads) == -1) {
+    /* could not read all 3 info. Process is gone? */
+    error_printf("Could not read info for process %d (gone already?)\n", pid);
+    return -1;
+  }
+  info->cmdline[0] = '\0';
+  return 0;
+}
+
+
+/* Return 1 if the process must not be monitored, because of the
+   filters or because it belongs to somebody else. The command line
+   may be read (and kept in 'info') on the way. */
+static int skip_process(int pid, struct proc_info* info,
+                        const struct option* const options)
+{
+  uid_t my_uid;
+
+  /* if "only" filter is set */
+  if (options->only_pid && (pid != options->only_pid))
+    return 1;
+
+  if (options->only_name) {
+    if (options->show_cmdline) {  /* show_cmdline is on */
+      get_cmdline(pid, info->cmdline, sizeof(info->cmdline));
+      if (strstr(info->cmdline, options->only_name) == NULL)
+        return 1;
+    }
+    else {  /* show_cmdline is off */
+      if (strstr(info->name, options->only_name) == NULL)
+        return 1;
+    }
+  }
+
+  /* drill-down into a single cgroup */
+  if (options->only_cgroup && !in_cgroup(pid, options->only_cgroup))
+    return 1;
+
+  /* All processes if I am root, only mine if I am not root. */
+  my_uid = options->euid;
+  if ((my_uid != 0) && (info->uid != my_uid)) /* not root, can monitor only mine */
+    return 1;
+
+  return 0;
+}
+
+
+/* Allocate a new task and insert it in the list of processes. Counters
+   are not started. */
+static struct process* add_task(struct process_list* const list,
+                                int pid, int tid, struct proc_info* info)
+{
+  struct process* ptr;
+  struct passwd*  passwd;
+  struct timeval  now;
+  int             zz;
+
+  /* allocate memory */
+  ptr = malloc(sizeof(struct process));
+
+  /* insert into list of processes */
+  /* Insert at the front of the list. This will later let us
+     scan the rest of the list when looking for idle processes,
+     closing files. */
+  ptr->next = list->processes;
+  list->processes = ptr;
+
+  /* update helper data structures */
+  if (list->num_tids == list->num_alloc) {
+    list->num_alloc *= 2;
+    list->proc_ptrs = realloc(list->proc_ptrs,
+                              list->num_alloc*sizeof(struct process*));
+  }
+  list->proc_ptrs[list->num_tids] = ptr;
+  list->num_tids++;
+  if (tid >= 0)  /* not the total row of the system-wide mode */
+    hash_add(tid, ptr);
+
+  /* fill in information for new process */
+  ptr->tid = tid;
+  ptr->pid = pid;
+  ptr->uid = info->uid;
+  ptr->proc_id = -1;
+  ptr->dead = 0;
+  ptr->inactive = 0;
+  ptr->gone = 0;
+  ptr->zombie = 0;
+  ptr->inherit = 0;
+  ptr->evicted = 0;
+  ptr->rotating = 0;
+  ptr->fresh = 0;
+  ptr->has_rate = 0;
+  ptr->estimated = 0;
+  ptr->accumulated = 0;
+  ptr->last_ticks = 0;
+  ptr->sets = NULL;
+  ptr->num_sets = 0;
+  ptr->num_events = 0;
+  for(zz = 0; zz < MAX_EVENTS; zz++)
+    ptr->fd[zz] = -1;  /* may be evicted before any counter is opened */
+  ptr->grp_leader = -1;
+  ptr->grp_members = 0;
+  ptr->run_ratio = -1;
+  ptr->stat_fd = -1;
+  ptr->history = NULL;
+  ptr->history_id = 0;
+  ptr->interval = 0;
+  ptr->u.d = 0.0;
+
+  passwd = getpwuid(info->uid);
+  if (passwd)
+    ptr->username = strdup(passwd->pw_name);
+  else
+    ptr->username = NULL;
+
+  ptr->num_threads = (short)info->num_threads;
+  if (info->cmdline[0] == '\0')
+    get_cmdline(pid, info->cmdline, sizeof(info->cmdline));
+  ptr->cmdline = strdup(info->cmdline);
+  ptr->name = strdup(info->name);
+  gettimeofday(&now, NULL);
+  ptr->timestamp = now;
+  ptr->prev_cpu_time_s = 0;
+  ptr->prev_cpu_time_u = 0;
+
+  /* initialize at 100 to avoid immediate collection as inactive */
+  ptr->cpu_percent =   100.0;
+  ptr->cpu_percent_s =   0.0;
+  ptr->cpu_percent_u = 100.0;
+
+  ptr->txt = malloc(TXT_LEN * sizeof(char));
+  ptr->txt[0] = '\0';
+
+  return ptr;
+}
+
+
+/* Return 1 if the task has been using more than 30% of a CPU since it
+   started. */
+static int is_active(int tid)
+{
+  char   name[50] = { 0 }; /* needs to fit /proc/xxxx/stat */
+  char   buf[STAT_BUF_LEN];
+  double uptime;
+  struct task_stat st;
+
+  if ((read_proc_file("/proc/uptime", buf, sizeof(buf)) == -1) ||
+      (parse_uptime(buf, &uptime) == -1))
+    return 0;
+  uptime *= clk_tck;
+
+  /* utime, stime and starttime */
+  snprintf(name, sizeof(name) - 1, "/proc/%d/stat", tid);
+  if ((read_proc_file(name, buf, sizeof(buf)) == -1) ||
+      (parse_stat(buf, &st) == -1))
+    return 0;
+
+  return ((st.utime + st.stime)/(uptime - st.starttime) > 0.3);
+}
+
+
+/* Prepare the attributes common to all counters. */
+void init_events_attr(struct STRUCT_NAME* events,
+                      const struct option* const options)
+{
+  memset(events, 0, sizeof(*events));
+  events->disabled = 0;
+  events->read_format = PERF_FORMAT_GROUP |
+                        PERF_FORMAT_TOTAL_TIME_ENABLED |
+                        PERF_FORMAT_TOTAL_TIME_RUNNING;
+  events->exclude_hv = 1;
+  /* events->exclude_idle = 1; ?? */
+  if (options->show_kernel == 0)
+    events->exclude_kernel = 1;
+}
+
+
+/* A new task was reported by the kernel (fork or exec). Add it unless
+   already known or filtered out. */
+static void new_task(struct process_list* const list,
+                     int pid, int tid,
+                     const screen_t* const screen,
+                     struct STRUCT_NAME* events,
+                     const struct option* const options)
+{
+  struct proc_info info;
+  struct process*  ptr;
+
+  if (list->inherit)  /* process mode: rows are processes */
+    tid = pid;
+  if (hash_get(tid))  /* already known */
+    return;
+  if (read_proc_info(pid, &info) == -1)  /* already gone */
+    return;
+  if (skip_process(pid, &info, options))
+    return;
+
+  ptr = add_task(list, pid, tid, &info);
+  ptr->inherit = list->inherit;
+  start_counters(ptr, screen, events, options);
+}
+
+
+/* A monitored task called exec: update its name and command line,
+   and drop it if it does not pass the filters anymore (--only-name,
+   or a setuid program that the user cannot monitor). The dead task is
+   freed by compact_proc_list, after the refresh. */
+static void exec_task(int pid, int tid, const struct option* const options)
+{
+  struct proc_info info;
+  struct process*  ptr = hash_get(tid);
+
+  update_name_cmdline(tid, 0);
+  if (read_proc_info(pid, &info) == -1)  /* gone, noticed at update */
+    return;
+  if (!skip_process(pid, &info, options))
+    return;
+
+  ptr->dead = 1;
+  close_files(ptr);
+}
+
+
+/* Process the events sent by the kernel since last time. Return -1 if
+   some events were lost, and /proc must be scanned again. */
+static int new_processes_from_events(struct process_list* const list,
+                                     const screen_t* const screen,
+                                     struct STRUCT_NAME* events,
+                                     const struct option* const options)
+{
+  struct proc_ev evs[256];
+  int n, i;
+
+  do {
+    n = proc_events_read(evs, sizeof(evs) / sizeof(evs[0]));
+    if (n == -1)
+      return -1;
+
+    for(i=0; i < n; i++) {
+      switch (evs[i].type) {
+      case PROC_EV_FORK:
+        /* process mode: new threads are covered by inheritance */
+        if (list->inherit && (evs[i].pid != evs[i].tid))
+          break;
+        new_task(list, evs[i].pid, evs[i].tid, screen, events, options);
+        break;
+
+      case PROC_EV_EXEC:
+        /* Name and command line changed. The process may now pass
+           the filters, if it did not before, or the other way round. */
+        if (hash_get(evs[i].tid))
+          exec_task(evs[i].pid, evs[i].tid, options);
+        else
+          new_task(list, evs[i].pid, evs[i].tid, screen, events, options);
+        break;
+
+      case PROC_EV_EXIT:
+        /* Nothing to do: update_proc_list notices that the task is
+           gone, after reading the final values of its counters. */
+        break;
+      }
+    }
+  } while (n == sizeof(evs) / sizeof(evs[0]));
+
+  return 0;
+}
+
+
+/* Same information as read_proc_info, for a new thread of an already
+   monitored process. */
+static void owner_proc_info(const struct process* const owner,
+                            int num_threads, struct proc_info* info)
+{
+  info->uid = owner->uid;
+  info->num_threads = num_threads;
+  strncpy(info->name, owner->name, sizeof(info->name) - 1);
+  info->name[sizeof(info->name) - 1] = '\0';
+  strncpy(info->cmdline, owner->cmdline, sizeof(info->cmdline) - 1);
+  info->cmdline[sizeof(info->cmdline) - 1] = '\0';
+}
+
+
+/* Add a task to an array of tasks whose counters are started at the
+   end of the scan. */
+static void queue(struct process* ptr, struct process*** tasks,
+                  int* num_tasks, int* alloc_tasks)
+{
+  (*tasks)[(*num_tasks)++] = ptr;
+  if (*num_tasks == *alloc_tasks) {
+    *alloc_tasks *= 2;
+    *tasks = realloc(*tasks, *alloc_tasks * sizeof(struct process*));
+  }
+}
+
+
+/* Add a task to the list of inactive ones, whose counters are
+   started after those of the active ones. */
+static void postpone(struct process* ptr, struct process*** inactive,
+                     int* num_inactive, int* alloc_inact)
+{
+  queue(ptr, inactive, num_inactive, alloc_inact);
+  /* Mark so that the collection of quasi-idle processes phase will
+     skip. Most data structures are not initialized yet. */
+  ptr->inactive = 1;
+}
+
+
+/* Remember what may change whether the process 'known', whose
+   directory is 'name' in /proc, passes the filters: its name and its
+   owner. */
+static void note_filtered(int proc_fd, const char* name,
+                          struct known_pid* known,
+                          const struct proc_info* info)
+{
+  struct stat st;
+
+  known->skipped = 1;
+  known->owner = (fstatat(proc_fd, name, &st, 0) == 0) ? st.st_uid :
+                                                          (uid_t)-1;
+  strncpy(known->name, info->name, sizeof(known->name) - 1);
+  known->name[sizeof(known->name) - 1] = '\0';
+}
+
+
+/* Return 1 if the process 'known', filtered out by a previous scan,
+   must go through the filters again: it called exec, or changed its
+   name, and a name is required, or it changed owner (setuid), and
+   only the processes of the user are monitored. Much cheaper than
+   reading its status. */
+static int filtered_changed(int proc_fd, const char* name,
+                            const struct known_pid* const known,
+                            const struct option* const options)
+{
+  char path[50], comm[20];
+  struct stat st;
+  int  n;
+
+  if ((options->euid != 0) &&
+      (fstatat(proc_fd, name, &st, 0) == 0) && (st.st_uid != known->owner))
+    return 1;
+
+  if (options->only_name) {
+    snprintf(path, sizeof(path), "/proc/%d/comm", known->pid);
+    n = read_proc_file(path, comm, sizeof(comm));
+    if (n == -1)  /* gone */
+      return 0;
+    if (comm[n - 1] == '\n')
+      comm[n - 1] = '\0';
+    if (strcmp(comm, known->name) != 0)
+      return 1;
+  }
+  return 0;
+}
+
+
+void new_processes(struct process_list* const list,
+                   const screen_t* const screen,
+                   const struct option* const options)
+{
+  struct dirent*     pid_dirent;
+  DIR*               pid_dir;
+  int                val, num_inactive, alloc_inact, i;
+  int                num_active, alloc_active;
+  struct STRUCT_NAME events;
+  char               buf[100];  /* content of /proc/loadavg */
+  struct process**   inactive;
+  struct process**   active;
+  static unsigned int gen = 0;  /* generation of the scan */
+
+  init_events_attr(&events, options);
+
+  /* When the kernel reports process creations, there is no need to
+     scan /proc, except the first time, or when events were lost. */
+  if (list->most_recent_pid && proc_events_active()) {
+    if (new_processes_from_events(list, screen, &events, options) == 0)
+      return;
+    list->most_recent_pid = 0;  /* force a full scan */
+  }
+
+  /* To avoid scanning the entire /proc directory, we first check if
+     any process has been created since last time. /proc/loadavg
+     contains the PID of the most recent process. We compare with our
+     own most recent. */
+  if ((read_proc_file("/proc/loadavg", buf, sizeof(buf)) != -1) &&
+      (parse_loadavg(buf, &val) == 0)) {
+    /* if no new process has been created since last time, just quit. */
+    if (val == list->most_recent_pid)
+      return;
+  }
+  else
+    val = -1;  /* unknown, scan now and next time */
+
+  list->most_recent_pid = val;
+  gen++;
+
+  num_inactive = 0;
+  alloc_inact = 100;
+  inactive = malloc(alloc_inact * sizeof(struct process*));
+  num_active = 0;
+  alloc_active = 100;
+  active = malloc(alloc_active * sizeof(struct process*));
+
+  /* check all directories of /proc */
+  pid_dir = opendir("/proc");
+  while ((pid_dirent = readdir(pid_dir))) {
+    int   pid, fresh;
+    struct proc_info  info;
+    struct known_pid* known;
+    struct process*   owner;
+    struct stat st;
+    DIR* thr_dir;
+    struct dirent* thr_dirent;
+    char task_name[50] = { 0 };
+
+    if (pid_dirent->d_type != DT_DIR)  /* not a directory */
+      continue;
+
+    if ((pid = atoi(pid_dirent->d_name)) == 0)  /* not a number */
+      continue;
+
+    /* Processes seen during previous scans are only looked at again
+       when their set of threads changed: the link count of
+       /proc/PID/task is the number of threads (+2). A reused PID gets
+       a new /proc/PID inode. */
+    known = known_get(pid);
+    fresh = (!known || (known->ino != pid_dirent->d_ino));
+    if (!known)
+      known = known_add(pid);
+    else if (fresh) {
+      known->skipped = 0;
+      known->nlink = 0;
+    }
+    known->ino = pid_dirent->d_ino;
+    known->gen = gen;
+
+    if (known->skipped) {  /* same process, filtered out */
+      if (!filtered_changed(dirfd(pid_dir), pid_dirent->d_name, known,
+                            options))
+        continue;
+      known->skipped = 0;
+      known->nlink = 0;
+    }
+
+    /* process mode: new threads need nothing, only new processes */
+    if (list->inherit && hash_get(pid))
+      continue;
+
+    snprintf(task_name, sizeof(task_name) - 1, "%d/task", pid);
+    if (fstatat(dirfd(pid_dir), task_name, &st, 0) == -1)  /* gone */
+      continue;
+    if (st.st_nlink == known->nlink)  /* no new thread */
+      continue;
+
+    /* For a new thread of a monitored process, everything is known
+       already. Otherwise, read /proc/PID/status. */
+    owner = fresh ? NULL : hash_get(pid);
+    if (owner)
+      owner_proc_info(owner, st.st_nlink - 2, &info);
+    else {
+      if (read_proc_info(pid, &info) == -1)
+        continue;
+
+      if (skip_process(pid, &info, options)) {
+        note_filtered(dirfd(pid_dir), pid_dirent->d_name, known, &info);
+        continue;
+      }
+    }
+    known->nlink = st.st_nlink;
+
+    if (list->inherit) {
+      struct process* ptr = add_task(list, pid, pid, &info);
+      ptr->inherit = 1;
+      if (is_active(pid))
+        queue(ptr, &active, &num_active, &alloc_active);
+      else
+        postpone(ptr, &inactive, &num_inactive, &alloc_inact);
+      continue;
+    }
+
+    snprintf(task_name, sizeof(task_name) - 1, "/proc/%d/task", pid);
+    thr_dir = opendir(task_name);
+    if (!thr_dir)  /* died just now? Will be marked dead at next iteration. */
+      continue;
+
+    /* Iterate over all threads in the process */
+    while ((thr_dirent = readdir(thr_dir))) {
+      struct process* ptr;
+      int tid;
+
+      tid = atoi(thr_dirent->d_name);
+      if (tid == 0)
+        continue;
+
+      if (hash_get(tid))  /* already known */
+        continue;
+
+      /* We have a new thread. */
+      ptr = add_task(list, pid, tid, &info);
+
+      /* Due to the limited number of files in a Linux process (each
+         counter corresponds to a file), we want to start counters
+         first for active process. Idle processes are
+         postponed. This increases the chances to display useful
+         information: a dash only for idle processes. */
+      if (is_active(tid)) {
+        /* active process: %CPU > 30% */
+        queue(ptr, &active, &num_active, &alloc_active);
+      }
+      else {
+        /* less active: postpone. */
+        postpone(ptr, &inactive, &num_inactive, &alloc_inact);
+      }
+    }
+    closedir(thr_dir);
+  }
+  closedir(pid_dir);
+
+  /* forget the PIDs that disappeared */
+  known_purge(gen);
+
+  /* start the counters, inactive processes last */
+  for(i=0; i < num_inactive; i++) {
+    inactive[i]->inactive = 0;
+    queue(inactive[i], &active, &num_active, &alloc_active);
+  }
+  free(inactive);
+  start_batch(active, num_active, screen, &events, options);
+  free(active);
+}
+
+
+/* Close the files of a task that died: counters and stat. */
+void close_files(struct process* const p)
+{
+  int zz;
+
+  for(zz=0; zz < p->num_events; ++zz) {
+    if (p->fd[zz] != -1) {
+      close(p->fd[zz]);
+      num_files--;
+      p->fd[zz] = -1;
+    }
+  }
+  p->grp_leader = -1;
+  p->grp_members = 0;
+  if (p->stat_fd != -1) {
+    close(p->stat_fd);
+    num_files--;
+    p->stat_fd = -1;
+  }
+  for(zz=0; zz < p->num_sets; ++zz)
+    close_files(p->sets[zz]);
+}
+
+
+/* Does the task hold at least one counter? */
+int has_counters(const struct process* const p)
+{
+  int zz;
+
+  for(zz = 0; zz < p->num_events; zz++) {
+    if (p->fd[zz] != -1)
+      return 1;
+  }
+  for(zz = 0; zz < p->num_sets; zz++) {
+    if (has_counters(p->sets[zz]))
+      return 1;
+  }
+  return 0;
+}
+
+
+/* Number of live tasks currently evicted, see budget.c. */
+int num_evicted_tasks(void)
+{
+  return num_evicted;
+}
+
+
+/* Read the content of /proc/PID/task/TID/stat in 'buf' (null
+   terminated). The file is kept open for the lifetime of the task and
+   re-read from the beginning with a single pread, as long as the
+   budget of files allows it. Otherwise it is opened and closed each
+   time. Return the number of bytes read, or -1 if the task is gone. */
+static int read_task_stat(struct process* const p, char* buf, int size)
+{
+  int n;
+
+  if (p->stat_fd == -1) {
+    char name[50] = { 0 };  /* needs to fit /proc/xxxx/task/xxxx/stat */
+    int  fd;
+
+    if (p->inherit)  /* whole process, all threads included */
+      snprintf(name, sizeof(name) - 1, "/proc/%d/stat", p->pid);
+    else
+      snprintf(name, sizeof(name) - 1, "/proc/%d/task/%d/stat", p->pid, p->tid);
+    fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+      return -1;
+    n = pread(fd, buf, size - 1, 0);
+
+    /* keep some room for the counters of new tasks (workers may race
+       on the check, the slack absorbs it) */
+    if ((n > 0) && (num_files + MAX_EVENTS < num_files_limit)) {
+      p->stat_fd = fd;
+      __sync_fetch_and_add(&num_files, 1);
+    }
+    else
+      close(fd);
+  }
+  else
+    n = pread(p->stat_fd, buf, size - 1, 0);
+
+  if (n <= 0)
+    return -1;
+  buf[n] = '\0';
+  return n;
+}
+
+
+/* Read the group of counters whose leader is slot 'first'. With
+   PERF_FORMAT_GROUP, the kernel returns the number of counters, the
+   times the group was enabled and actually running on the PMU, then
+   the values: the leader first, then the members in the order they
+   were attached, which is the order of the slots.
+
+   Counters are not pinned: when there are more events than hardware
+   counters, the kernel time-multiplexes the groups. The increment of
+   each counter is then extrapolated to the whole period, using the
+   increments of the enabled and running times. values[] accumulate
+   these extrapolated increments, raw[] keep what the kernel returned.
+   Return the fraction of the period the group was running, or -1 if
+   the task did not run. */
+static double read_group(struct process* const proc, int first)
+{
+  uint64_t buf[3 + MAX_EVENTS];
+  uint64_t nr = 0;
+  uint64_t enabled = 0, running = 0;
+  uint64_t i = 0;
+  int      n, zz;
+
+  n = read(proc->fd[first], buf, sizeof(buf));
+  if (n >= (int)(3 * sizeof(uint64_t)))
+    nr = buf[0];
+  if (n < (int)((3 + nr) * sizeof(uint64_t)))  /* short read, error */
+    nr = 0;
+  if (nr) {
+    enabled = buf[1] - proc->time_enabled[first];
+    running = buf[2] - proc->time_running[first];
+  }
+
+  for(zz = first; zz < proc->num_events; zz++) {
+    if ((zz != first) &&
+        ((first != proc->grp_leader) || !(proc->grp_members & (1U << zz))))
+      continue;  /* not in this group */
+
+    if (i < nr) {
+      uint64_t delta = buf[3 + i] - proc->raw[zz];
+      if (running == 0)  /* did not run at all, nothing to extrapolate */
+        delta = 0;
+      else if (running < enabled)  /* multiplexed */
+        delta = (uint64_t)((double)delta * enabled / running + 0.5);
+      proc->values[zz] += delta;
+      proc->raw[zz] = buf[3 + i];
+      proc->time_enabled[zz] = buf[1];
+      proc->time_running[zz] = buf[2];
+    }
+    else
+      proc->values[zz] = 0;
+    i++;
+  }
+
+  if (enabled == 0)
+    return -1;
+  return (double)running / enabled;
+}
+
+
+/* Read all the counters of a task, one read() per group. The
+   running ratio of the task is the lowest ratio of its groups over
+   the last period (unchanged if the task did not run). */
+void read_counters(struct process* const proc)
+{
+  double ratio = 2;  /* above any valid ratio */
+  int    zz;
+
+  for(zz = 0; zz < proc->num_events; zz++) {
+    if (proc->fd[zz] == -1)  /* the syscall failed on that counter */
+      proc->values[zz] = 0xffffffff;  /* use marker */
+    else if (!(proc->grp_members & (1U << zz))) {  /* leader, or alone */
+      double r = read_group(proc, zz);
+      if ((r >= 0) && (r < ratio))
+        ratio = r;
+    }
+  }
+  if (ratio <= 1)
+    proc->run_ratio = ratio;
+}
+
+
+/* Timestamp the refresh of 'proc', and keep the seconds elapsed since
+   the previous one (for rate and the functions over time). */
+void update_interval(struct process* const proc)
+{
+  struct timeval  now;
+
+  gettimeofday(&now, NULL);
+  proc->interval = (now.tv_sec - proc->timestamp.tv_sec) +
+    (now.tv_usec - proc->timestamp.tv_usec)/1000000.0;
+  proc->timestamp = now;
+}
+
+
+/* Compute %CPU from the user and system times (in clock ticks) spent
+   since the previous refresh. */
+void update_cpu_percent(struct process* const proc,
+                        unsigned long utime, unsigned long stime)
+{
+  double    elapsed;
+  unsigned long   prev_cpu_time, curr_cpu_time;
+
+  update_interval(proc);
+  elapsed = proc->interval * clk_tck;
+
+  prev_cpu_time = proc->prev_cpu_time_s + proc->prev_cpu_time_u;
+  curr_cpu_time = stime + utime;
+  proc->cpu_percent = 100.0*(curr_cpu_time - prev_cpu_time)/elapsed;
+  proc->cpu_percent_s = 100.0*(stime - proc->prev_cpu_time_s)/elapsed;
+  proc->cpu_percent_u = 100.0*(utime - proc->prev_cpu_time_u)/elapsed;
+
+  proc->prev_cpu_time_s = stime;
+  proc->prev_cpu_time_u = utime;
+}
+
+
+/* Evicted task: extrapolate the counters from the rates learned during
+   its last rotation slice, in proportion to the CPU time it used. */
+static void estimate(struct process* const proc)
+{
+  int zz;
+
+  for(zz = 0; zz < proc->num_events; zz++) {
+    if (proc->rate[zz] < 0) {  /* could not be counted */
+      proc->values[zz] = 0xffffffff;
+      continue;
+    }
+    if (proc->values[zz] == 0xffffffff)
+      proc->values[zz] = 0;
+    proc->prev_values[zz] = proc->values[zz];
+    proc->values[zz] += (uint64_t)(proc->rate[zz] * proc->last_ticks + 0.5);
+  }
+  proc->run_ratio = 0;  /* nothing was actually counted */
+  proc->estimated = 1;
+}
+
+
+/* Sample one task: %CPU and processor from its stat file, and values
+   of the counters. Called concurrently by the workers on distinct
+   tasks: only the task itself is modified. Tasks that vanished or
+   became zombies are only flagged, they are handled by the caller
+   once all workers are done. */
+static void update_task(struct process* const proc)
+{
+  char      stat_buf[STAT_BUF_LEN];
+  struct task_stat st;
+  unsigned long   utime = 0, stime = 0;
+  int             proc_id, zz;
+
+  restore_own_values(proc);
+
+  /* Compute %CPU, retrieve processor ID. */
+  if (read_task_stat(proc, stat_buf, sizeof(stat_buf)) == -1) {
+    proc->gone = 1;  /* this task disappeared */
+    return;
+  }
+
+  if (parse_stat(stat_buf, &st) == -1) {
+    st.state = ' ';
+    st.utime = st.stime = 0;
+    st.processor = -1;
+  }
+  utime = st.utime;
+  stime = st.stime;
+  proc_id = st.processor;
+
+  if (st.state == 'Z')
+    proc->zombie = 1;
+
+  /* do not update these values for a zombie, they have become invalid */
+  proc->last_ticks = 0;
+  if (!proc->zombie) {
+    proc->last_ticks = (utime + stime) -
+                       (proc->prev_cpu_time_u + proc->prev_cpu_time_s);
+    update_cpu_percent(proc, utime, stime);
+  }
+
+  proc->proc_id = (short)proc_id;
+  /* Backup previous value of counters */
+  for(zz = 0; zz < proc->num_events; zz++)
+    proc->prev_values[zz] = proc->values[zz];
+  if (proc->fresh) {  /* first counters after an eviction */
+    for(zz = 0; zz < proc->num_events; zz++) {
+      if (proc->values[zz] == 0xffffffff)
+        proc->values[zz] = proc->prev_values[zz] = 0;
+    }
+  }
+
+  proc->estimated = 0;
+  if (proc->num_sets) {  /* process mode */
+    for(zz = 0; zz < proc->num_sets; zz++)
+      read_counters(proc->sets[zz]);
+    sum_counters(proc, (const struct process* const*)proc->sets,
+                 proc->num_sets);
+    if (proc->fresh) {  /* new sets, counting from zero */
+      for(zz = 0; zz < proc->num_events; zz++)
+        proc->prev_values[zz] = 0;
+    }
+  }
+  else if (proc->evicted && proc->has_rate && !has_counters(proc))
+    estimate(proc);
+  else
+    read_counters(proc);
+  proc->fresh = 0;
+}
+
+
+/* Worker entry point: sample the live tasks of proc_ptrs[first, last). */
+static void update_tasks(void* arg, int first, int last)
+{
+  struct process** const proc_ptrs = arg;
+  int i;
+
+  for(i = first; i < last; i++) {
+    if (!proc_ptrs[i]->dead)
+      update_task(proc_ptrs[i]);
+  }
+}
+
+
+/* Create a row that is not a task (a CPU, a cgroup...), identified by
+   'id' in the PID column. Negative IDs are not hashed. */
+struct process* add_pseudo_task(struct process_list* const list,
+                                int id, const char* name)
+{
+  struct proc_info info;
+  struct process*  ptr;
+
+  info.uid = 0;
+  info.num_threads = 1;
+  snprintf(info.name, sizeof(info.name), "%s", name);
+  strcpy(info.cmdline, info.name);
+
+  ptr = add_task(list, id, id, &info);
+  if (ptr->username)
+    free(ptr->username);
+  ptr->username = strdup("-");
+  ptr->cpu_percent = ptr->cpu_percent_u = 0.0;
+  return ptr;
+}
+
+
+/* Set the counters of 'dst' to the sum of those of the 'num' entries
+   of 'src' ('dst' itself and the dead entries are skipped). A value is
+   invalid as soon as one of the terms is. The running ratio is the
+   lowest one. */
+void sum_counters(struct process* const dst,
+                  const struct process* const* const src, int num)
+{
+  int i, zz;
+
+  dst->run_ratio = -1;
+  for(zz = 0; zz < dst->num_events; zz++) {
+    dst->prev_values[zz] = dst->values[zz];
+    dst->values[zz] = 0;
+  }
+  for(i = 0; i < num; i++) {
+    const struct process* const p = src[i];
+    if ((p == dst) || p->dead)
+      continue;
+    if ((p->run_ratio >= 0) &&
+        ((dst->run_ratio < 0) || (p->run_ratio < dst->run_ratio)))
+      dst->run_ratio = p->run_ratio;
+    for(zz = 0; zz < dst->num_events; zz++) {
+      if ((p->values[zz] == 0xffffffff) || (dst->values[zz] == 0xffffffff))
+        dst->values[zz] = 0xffffffff;
+      else
+        dst->values[zz] += p->values[zz];
+    }
+  }
+}
+
+
+/*
+ * System-wide mode (--per-cpu): instead of tasks, the rows are the
+ * CPUs, plus a total row. The counters of the screen are opened once
+ * per CPU (pid -1), whatever the number of tasks running on the
+ * machine. %CPU comes from /proc/stat, which only lists the online
+ * CPUs: the row of a CPU that went offline is dead, its counters are
+ * closed. Return the number of dead rows.
+ */
+static int update_cpu_list(struct process_list* const list,
+                           const screen_t* const screen,
+                           const struct option* const options)
+{
+  struct STRUCT_NAME events;
+  struct process* const total = list->total;
+  struct cpu_stat st;
+  const char* p;
+  char* buf;
+  int   size, zz, i;
+  int   num_dead = 0, num_offline = 0;
+
+  /* the cpu lines come first, roughly 100 bytes each */
+  size = 256 + 128 * sysconf(_SC_NPROCESSORS_CONF);
+  buf = malloc(size);
+  if (read_proc_file("/proc/stat", buf, size) == -1) {
+    free(buf);
+    return 0;
+  }
+
+  init_events_attr(&events, options);
+
+  if (!total) {
+    list->total = add_pseudo_task(list, -1, "total");
+    list->total->num_events = screen->num_counters;
+    for(zz = 0; zz < screen->num_counters; zz++) {
+      list->total->fd[zz] = -1;
+      list->total->values[zz] = 0;
+    }
+  }
+
+  /* the CPUs not listed anymore are offline */
+  for(i = 0; i < list->num_tids; i++) {
+    if (list->proc_ptrs[i] != list->total)
+      list->proc_ptrs[i]->gone = 1;
+  }
+
+  for(p = buf; (p = parse_cpu_stat(p, &st)); ) {
+    struct process* row;
+
+    if (st.cpu == -1)  /* summary line, computed below from the CPUs */
+      continue;
+
+    row = hash_get(st.cpu);
+    if (!row) {  /* first refresh, or CPU brought online */
+      char name[20];
+      snprintf(name, sizeof(name), "cpu%d", st.cpu);
+      row = add_pseudo_task(list, st.cpu, name);
+      row->proc_id = (short)st.cpu;
+      row->num_events = screen->num_counters;
+      restore_privilege();
+      open_counters(row, screen, &events, -1, st.cpu, 0);
+      drop_privilege();
+    }
+    else if (row->dead) {  /* back online, the row was kept (sticky) */
+      row->dead = 0;
+      restore_privilege();
+      open_counters(row, screen, &events, -1, st.cpu, 0);
+      drop_privilege();
+    }
+    row->gone = 0;
+
+    update_cpu_percent(row, st.user, st.system);
+    for(zz = 0; zz < row->num_events; zz++)
+      row->prev_values[zz] = row->values[zz];
+    read_counters(row);
+  }
+  free(buf);
+
+  for(i = 0; i < list->num_tids; i++) {
+    struct process* const row = list->proc_ptrs[i];
+    if (row->gone) {
+      row->gone = 0;
+      if (!row->dead) {
+        row->dead = 1;
+        close_files(row);
+        num_offline++;
+      }
+    }
+    if (row->dead)
+      num_dead++;
+  }
+
+  /* total row: sum of the CPUs */
+  if (total) {
+    update_interval(total);
+    total->cpu_percent = total->cpu_percent_s = total->cpu_percent_u = 0;
+    for(i = 0; i < list->num_tids; i++) {
+      const struct process* const row = list->proc_ptrs[i];
+      if ((row == total) || row->dead)
+        continue;
+      total->cpu_percent += row->cpu_percent;
+      total->cpu_percent_s += row->cpu_percent_s;
+      total->cpu_percent_u += row->cpu_percent_u;
+    }
+    sum_counters(total, (const struct process* const*)list->proc_ptrs,
+                 list->num_tids);
+
+    /* the counts of the CPUs gone offline are not in the total
+       anymore: the previous total must not include them either */
+    if (num_offline) {
+      for(zz = 0; zz < total->num_events; zz++) {
+        total->prev_values[zz] = 0;
+        for(i = 0; i < list->num_tids; i++) {
+          const struct process* const row = list->proc_ptrs[i];
+          if ((row == total) || row->dead)
+            continue;
+          if ((row->prev_values[zz] == 0xffffffff) ||
+              (total->prev_values[zz] == 0xffffffff))
+            total->prev_values[zz] = 0xffffffff;
+          else
+            total->prev_values[zz] += row->prev_values[zz];
+        }
+      }
+    }
+  }
+  return num_dead;
+}
+
+
+/* Round-robin rotation of the counters among the evicted tasks.
+
+   The evicted tasks that were given counters at the previous refresh
+   have just been read: their increments over a whole period give the
+   rate of each event per tick of CPU time, and their counters are
+   closed again. The next evicted tasks, in list order, get the
+   reserved files for the coming period. In between, the values of an
+   evicted task are extrapolated from its rates and the CPU time it
+   used (see estimate), and flagged as such. */
+static void rotate(struct process_list* const list,
+                   const screen_t* const screen,
+                   const struct option* const options)
+{
+  struct STRUCT_NAME events;
+  struct process*    p;
+  int                num_candidates = 0, pos = 0, zz;
+
+  for(p = list->processes; p; p = p->next) {
+    if (!p->rotating)
+      continue;
+    if (p->last_ticks) {
+      for(zz = 0; zz < p->num_events; zz++) {
+        if ((p->values[zz] == 0xffffffff) ||
+            (p->prev_values[zz] == 0xffffffff))
+          p->rate[zz] = -1;
+        else
+          p->rate[zz] = (double)(p->values[zz] - p->prev_values[zz]) /
+                        p->last_ticks;
+      }
+      p->has_rate = 1;
+    }
+    release_counters(p);
+    p->rotating = 0;
+  }
+
+  for(p = list->processes; p; p = p->next) {
+    if (p->evicted && !p->dead && !p->inactive)
+      num_candidates++;
+  }
+  if (num_candidates == 0)
+    return;
+
+  /* take the reserve back from the least active tasks, if needed */
+  make_room(0, HUGE_VAL, options);
+
+  init_events_attr(&events, options);
+  rotation_next %= num_candidates;
+  for(p = list->processes; p; p = p->next) {
+    uint64_t values[MAX_EVENTS], prev_values[MAX_EVENTS];
+
+    if (!p->evicted || p->dead || p->inactive)
+      continue;
+    if (pos++ < rotation_next)
+      continue;
+    if (num_files + files_needed(p) >= num_files_limit)
+      break;
+
+    /* the values of this period must still be displayed */
+    memcpy(values, p->values, sizeof(values));
+    memcpy(prev_values, p->prev_values, sizeof(prev_values));
+    restore_privilege();
+    if (p->inherit)
+      open_inherited(p, screen, &events);
+    else
+      open_counters(p, screen, &events, p->tid, -1, 0);
+    drop_privilege();
+    memcpy(p->values, values, sizeof(values));
+    memcpy(p->prev_values, prev_values, sizeof(prev_values));
+
+    rotation_next++;
+    if (!has_counters(p)) {
+      /* refused for another reason than files (permissions...), it
+         is not evicted anymore, just failed */
+      release_counters(p);
+      p->evicted = 0;
+      num_evicted--;
+      continue;
+    }
+    p->rotating = 1;
+    p->fresh = 1;
+  }
+  if (!p)  /* reached the end, start over next time */
+    rotation_next = 0;
+}
+
+
+/*
+ * Update all processes in the list with newly collected statistics.
+ * Return the number of dead processes.
+ */
+int update_proc_list(struct process_list* const list,
+                     const screen_t* const screen,
+                     struct option* const options)
+{
+  int    num_dead = 0;
+  int    i;
+
+  assert(screen);
+  assert(list && list->proc_ptrs);
+
+  if (options->cgroup_dir)
+    return update_cgroup_list(list, screen, options);
+  if (options->per_cpu)
+    return update_cpu_list(list, screen, options);
+
+  /* the %CPU of the tasks changed since the last eviction decisions */
+  budget_invalidate(list);
+
+  /* add newly created processes/threads, then give the active ones
+     among the evicted their counters back */
+  new_processes(list, screen, options);
+  reattach(screen, options);
+
+  /* update statistics, possibly in parallel */
+  workers_run(update_tasks, list->proc_ptrs, list->num_tids);
+
+  /* Merge, in list order. Everything that touches shared state (file
+     budget, known PIDs, children) is done here, sequentially. */
+  for(i = 0; i < list->num_tids; i++) {
+    struct process* const proc = list->proc_ptrs[i];
+
+    if (proc->gone) {
+      struct known_pid* known = known_get(proc->pid);
+      if (known)  /* a new thread may reuse the slot, rescan next time */
+        known->nlink = 0;
+      proc->gone = 0;
+      proc->dead = 1;  /* mark dead */
+      close_files(proc);
+    }
+    else if (proc->zombie) {
+      proc->zombie = 0;
+      proc->dead = 1;
+      wait_for_child(proc->tid, options);
+    }
+    if (proc->dead && proc->evicted) {
+      proc->evicted = 0;
+      proc->rotating = 0;
+      num_evicted--;
+    }
+    if (proc->dead)
+      num_dead++;
+  }
+
+  rotate(list, screen, options);
+  return num_dead;
+}
+
+
+/* Scan list of processes and deallocates the dead ones, compacting the list. */
+void compact_proc_list(struct process_list* const list)
+{
+  struct process** pp;
+  int i, num;
+
+  /* drop the dead tasks from the pointers, keeping the order of the
+     others: it is the order of the last sort (see batch mode) */
+  num = 0;
+  for(i = 0; i < list->num_tids; i++) {
+    if (!list->proc_ptrs[i]->dead)
+      list->proc_ptrs[num++] = list->proc_ptrs[i];
+  }
+
+  pp = &list->processes;
+  while (*pp) {
+    struct process* to_delete = *pp;
+    if (!to_delete->dead) {
+      pp = &to_delete->next;
+      continue;
+    }
+    hash_del(to_delete->tid);
+    *pp = to_delete->next;
+    done_proc(to_delete);
+    free(to_delete);
+  }
+  list->num_tids = num;
+
+  /* the heaps of the budget point to the tasks */
+  budget_invalidate(list);
+}
+
+
+/*
+ * When threads are not displayed, this function accumulates
+ * per-thread statistics in the parent process (which is also a
+ * thread).
+ */
+void accumulate_stats(const struct process_list* const list)
+{
+  int zz;
+  struct process* p;
+
+  /* process mode: no thread entries, the counters are inherited */
+  if (list->inherit)
+    return;
+
+  /* The values of a process become the totals of its threads, until
+     it is read again (see update_task). */
+  for(p = list->processes; p; p = p->next) {
+    if (p->pid != p->tid)
+      continue;
+    restore_own_values(p);
+    memcpy(p->own_values, p->values, p->num_events * sizeof(p->values[0]));
+    memcpy(p->own_prev_values, p->prev_values,
+           p->num_events * sizeof(p->prev_values[0]));
+    p->accumulated = 1;
+  }
+
+  for(p = list->processes; p; p = p->next) {
+    if (p->pid != p->tid) {
+      struct process* owner;
+
+      if (p->dead)
+        continue;
+
+      /* find the owner */
+      owner = hash_get(p->pid);
+      assert(owner);
+
+      /* accumulate in owner process */
+      owner->cpu_percent += p->cpu_percent;
+      if (p->estimated)
+        owner->estimated = 1;
+      for(zz = 0; zz < p->num_events; zz++) {
+        /* as soon as one thread has an invalid value, mark the owner
+           as invalid as well (cannot compute a correct value) */
+        if ((p->values[zz] == 0xffffffff) ||
+            (p->prev_values[zz] == 0xffffffff))
+          owner->values[zz] = 0xffffffff;
+        else if (owner->values[zz] != 0xffffffff) {
+          owner->values[zz] += p->values[zz];
+          owner->prev_values[zz] += p->prev_values[zz];
+        }
+      }
+    }
+  }
+}
+
+
+/* Right after a fork, the process name and command line are the
+   parent's. They are correct after exec. update_name_cmdline is
+   invoked when the kernel reports the exec (see proc-events.c) or,
+   when tiptop fires a command itself without process events, a
+   little while after exec to fix these fields. */
 void update_name_cmdline(int pid, int name_only)
 {
-  FILE* f;
   char  name[50] = { 0 };  /* needs to fit /proc/xxxx/{status,cmdline} */
-  char  line[100];  /* line of /proc/xxxx/status */
+  char  buf[STATUS_BUF_LEN];  /* content of /proc/xxxx/status */
   char  proc_name[100];
+  int   uid, num_threads;
 
   struct process* p = hash_get(pid);
   if (!p)  /* gone? */
@@ -714,18 +2290,11 @@ void update_name_cmdline(int pid, int name_only)
 
   /* update name */
   snprintf(name, sizeof(name) - 1, "/proc/%d/status", pid);
-  f = fopen(name, "r");
-  if (f) {
-    while (fgets(line, sizeof(line), f)) {
-      if (strncmp(line, "Name:", 5) == 0) {
-        sscanf(line, "%*s %s", proc_name);
-        if (p->name)
-          free(p->name);
-        p->name = strdup(proc_name);
-        break;
-      }
-    }
-    fclose(f);
+  if ((read_proc_file(name, buf, sizeof(buf)) != -1) &&
+      (parse_status(buf, proc_name, sizeof(proc_name), &uid, &num_threads) == 0)) {
+    if (p->name)
+      free(p->name);
+    p->name = strdup(proc_name);
   }
 
   if (!name_only) {  /* update command line */
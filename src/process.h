@@ -15,11 +15,14 @@
 #include <sys/time.h>
 #include <sys/types.h>
 
+#include "pmc.h"
 #include "screen.h"
 
 
 #define MAX_EVENTS 16
 #define TXT_LEN   200  /* max size of the text representation (or row) */
+#define STAT_BUF_LEN 1024  /* fits the content of /proc/PID/task/TID/stat */
+#define STATUS_BUF_LEN 8192  /* fits /proc/PID/status, even with many groups */
 
 
 /* An instance of this union is owned by each process. It is used to
@@ -36,6 +39,7 @@ union sorting_column {
 struct process {
   pid_t    tid;           /* thread ID */
   pid_t    pid;           /* process ID. For owning process, tip == pid */
+  uid_t    uid;           /* owner */
   short    proc_id;       /* processor ID on which process was last seen */
   short    num_threads;   /* number of threads in brotherhood */
   int      num_events;
@@ -45,12 +49,29 @@ struct process {
   double   cpu_percent_u; /* %CPU user */
 
   struct timeval timestamp;         /* timestamp of last update */
+  double   interval;      /* seconds between the last two updates */
   unsigned long prev_cpu_time_s;    /* system */
   unsigned long prev_cpu_time_u;    /* user */
 
+  int       stat_fd;                  /* /proc/PID/task/TID/stat, or -1 */
   int       fd[MAX_EVENTS];           /* file handles */
+  int       grp_leader;               /* slot leading the group, or -1 */
+  unsigned int grp_members;           /* bitmask of slots attached to it */
   uint64_t  values[MAX_EVENTS];       /* values read from counters */
   uint64_t  prev_values[MAX_EVENTS];  /* previous iteration */
+  uint64_t  raw[MAX_EVENTS];          /* last values returned by the kernel */
+  uint64_t  time_enabled[MAX_EVENTS]; /* for multiplexing, see read_group */
+  uint64_t  time_running[MAX_EVENTS];
+  uint64_t  own_values[MAX_EVENTS];   /* of the task alone, while values */
+  uint64_t  own_prev_values[MAX_EVENTS];  /* include its threads */
+  double    run_ratio;  /* fraction of last period counted, -1 unknown */
+  double    rate[MAX_EVENTS];  /* evicted: events per tick of CPU, or -1 */
+  unsigned long last_ticks;    /* CPU time of the last period, in ticks */
+  struct process** sets;  /* process mode: counters of the threads */
+  int       num_sets;
+  double*   history;   /* state of the functions over time (ewma...) */
+  unsigned int history_id;  /* program it belongs to */
+  struct timeval history_stamp;  /* last sample accounted in it */
   char* txt;  /* text representation of the process (what is displayed) */
 
   union sorting_column u;
@@ -62,6 +83,16 @@ struct process {
   unsigned int dead : 1;  /* is the process dead? */
   unsigned int inactive : 1;  /* temporary mark processes with low activity */
   unsigned int skip : 1;  /* do not display, for any reason (dead, idle...) */
+  unsigned int gone : 1;    /* vanished during the last sampling pass */
+  unsigned int zombie : 1;  /* became a zombie during the last sampling pass */
+  unsigned int inherit : 1; /* whole process, counters inherited by threads */
+  unsigned int evicted : 1; /* counters closed to save files, see budget.c */
+  unsigned int rotating : 1;  /* evicted, has counters for one period */
+  unsigned int fresh : 1;     /* counters opened since the last read */
+  unsigned int has_rate : 1;  /* rate[] learned during a rotation slice */
+  unsigned int estimated : 1; /* values extrapolated from rate[] */
+  unsigned int accumulated : 1; /* values include the threads, see
+                                   accumulate_stats */
 
   struct process* next;
 };
@@ -75,21 +106,59 @@ struct process_list {
 
   struct process* processes;
   struct process** proc_ptrs;
+  struct process* total;  /* total row in system-wide mode, or NULL */
+  int inherit;  /* process mode: one row per process, no thread entry */
 };
 
 
-struct process_list* init_proc_list();
+struct process_list* init_proc_list(const struct option* const options);
 void done_proc_list(struct process_list*);
 void new_processes(struct process_list* const list,
                    const screen_t* const screen,
                    const struct option* const options);
+
+/* Called while the counters of many new tasks are attached. */
+typedef void (*attach_progress_t)(int done, int total);
+void set_attach_progress(attach_progress_t fun);
+
+int  change_counters(struct process_list* const list,
+                     const counter_t* const old, int num_old,
+                     const screen_t* const screen,
+                     const struct option* const options);
+int  switch_counters(struct process_list* const list,
+                     const screen_t* const old,
+                     const screen_t* const screen,
+                     const struct option* const options);
+void rescan_proc_list(struct process_list* const list);
 int  update_proc_list(struct process_list* const,
                       const screen_t* const,
                       struct option* const);
 void compact_proc_list(struct process_list* const);
 void accumulate_stats(const struct process_list* const);
-void reset_values(const struct process_list* const);
 
 void update_name_cmdline(int pid, int name_only);
 
+/* building blocks for the modes where rows are not tasks */
+struct process* add_pseudo_task(struct process_list* const list,
+                                int id, const char* name);
+struct process* new_counter_set(int tid, const char* name, int num_events);
+void init_events_attr(struct STRUCT_NAME* events,
+                      const struct option* const options);
+void open_counters(struct process* ptr,
+                   const screen_t* const screen,
+                   struct STRUCT_NAME* events,
+                   pid_t pid, int cpu, unsigned long flags);
+void read_counters(struct process* const proc);
+void close_files(struct process* const p);
+int  has_counters(const struct process* const p);
+int  num_evicted_tasks(void);
+int  files_budget(int* used);
+int  take_file(void);
+void release_file(void);
+void sum_counters(struct process* const dst,
+                  const struct process* const* const src, int num);
+void update_interval(struct process* const proc);
+void update_cpu_percent(struct process* const proc,
+                        unsigned long utime, unsigned long stime);
+
 #endif  /* _PROCESS_H */
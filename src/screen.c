@@ -49,26 +49,43 @@ static screen_t** screens = NULL;
  * of a screen.
  */
 
+/* Is 'alias' a value provided by tiptop itself, rather than a
+   counter? */
+static int builtin_alias(const char* alias)
+{
+  return (strcmp(alias, "CPU_TOT") == 0 ||
+          strcmp(alias, "CPU_SYS") == 0 ||
+          strcmp(alias, "CPU_USER") == 0 ||
+          strcmp(alias, "PROC_ID") == 0 ||
+          strcmp(alias, "RUN_RATIO") == 0);
+}
+
+
+/* Index of the counter 'alias' in screen 's' (the last one, if
+   declared twice), or -1. */
+static int find_counter(const screen_t* const s, const char* alias)
+{
+  int i, found = -1;
+
+  for(i=0; i < s->num_counters; i++) {
+    assert(s->counters[i].alias != NULL);
+    if (strcmp(alias, s->counters[i].alias) == 0)
+      found = i;
+  }
+  return found;
+}
+
+
 /* Navigate into expressions, and mark used counters */
 static void check_counters_used(expression* e, screen_t* s, int* error)
 {
-
-  int i = 0;
   int found;
 
   if (e->type == ELEM && e->ele->type == COUNT) {
-    found = -1;
-    if (strcmp(e->ele->alias, "CPU_TOT") == 0 ||
-        strcmp(e->ele->alias, "CPU_SYS") == 0 ||
-        strcmp(e->ele->alias, "CPU_USER") == 0 ||
-        strcmp(e->ele->alias, "PROC_ID") == 0 )
+    if (builtin_alias(e->ele->alias))
       return ;
 
-    for(i=0; i < s->num_counters; i++) {
-      assert(s->counters[i].alias != NULL);
-      if (strcmp(e->ele->alias, s->counters[i].alias) == 0)
-        found = i;
-    }
+    found = find_counter(s, e->ele->alias);
 
     if (found >= 0)
       s->counters[found].used++;
@@ -78,6 +95,8 @@ static void check_counters_used(expression* e, screen_t* s, int* error)
       (*error)++;
     }
   }
+  else if (e->type == ERROR)  /* reported by the parser */
+    (*error)++;
   else if (e->type == OPER && e->op != NULL) {
     check_counters_used(e->op->exp1, s, error);
     check_counters_used(e->op->exp2, s, error);
@@ -85,24 +104,34 @@ static void check_counters_used(expression* e, screen_t* s, int* error)
 }
 
 
+/* Compile the expressions of the columns of 's' with its current
+   counters. */
+static void compile_columns(screen_t* const s)
+{
+  free_program(s->program);
+  s->program = compile_screen(s);
+}
+
+
 /* delete unmarked counters */
-static void delete_and_shift_counters(int sc, int co)
+static void delete_and_shift_counters(screen_t* const s, int co)
 {
   int i;
-  int nbc = screens[sc]->num_counters;
-  counter_t* tmp = &screens[sc]->counters[co];
+  int nbc = s->num_counters;
+  counter_t* tmp = &s->counters[co];
 
   if (tmp->alias)
     free(tmp->alias);
 
   for(i=co; i < nbc-1; i++) {
-    tmp = &screens[sc]->counters[i];
-    tmp->type   = screens[sc]->counters[i+1].type;
-    tmp->config = screens[sc]->counters[i+1].config;
-    tmp->alias  = screens[sc]->counters[i+1].alias;
-    tmp->used   = screens[sc]->counters[i+1].used;
+    tmp = &s->counters[i];
+    tmp->type   = s->counters[i+1].type;
+    tmp->config = s->counters[i+1].config;
+    tmp->alias  = s->counters[i+1].alias;
+    tmp->used   = s->counters[i+1].used;
   }
-  screens[sc]->num_counters--;
+  s->num_counters--;
+  compile_columns(s);  /* indices have changed */
 }
 
 
@@ -118,7 +147,7 @@ void tamp_counters ()
         error_printf("Unused counter '%s' in screen '%s'\n",
                      screens[i]->counters[j].alias,
                      screens[i]->name);
-        delete_and_shift_counters(i, j);
+        delete_and_shift_counters(screens[i], j);
       }
       else
         j++;
@@ -133,6 +162,7 @@ static screen_t* alloc_screen()
   s-> desc = NULL;
   s->counters = NULL;
   s->columns = NULL;
+  s->program = NULL;
 
   s->num_counters = 0;
   s->num_alloc_counters = 0;
@@ -180,6 +210,7 @@ screen_t* new_screen(char* name, char* desc, int prepend)
   the_screen->num_columns = 0;
   the_screen->num_alloc_columns = alloc_chunk;
   the_screen->columns = malloc(alloc_chunk * sizeof(column_t));
+  compile_columns(the_screen);  /* no column yet */
 
   if (num_screens >= num_alloc_screens) {
     num_alloc_screens += alloc_chunk;
@@ -488,6 +519,7 @@ int add_column(screen_t* const s, char* header, char* format, char* desc,
     s->columns[n].description = strdup("(unknown)");
 
   s->num_columns++;
+  compile_columns(s);
   return n;
 }
 
@@ -590,6 +622,8 @@ char* gen_header(const screen_t* const s, const struct option* options,
   const char sep = ' ';
   const char high_on = '[';
   const char high_off = ']';
+  const char* const id = options->cgroup_dir ? "CGR" :
+                         options->per_cpu ? "CPU" : "PID";
 
   assert(pid_width >= 5);
 
@@ -609,14 +643,14 @@ char* gen_header(const screen_t* const s, const struct option* options,
   }
 
   if (options->show_user)
-    written = snprintf(ptr, width, "%*s%cPID%c user      ",
+    written = snprintf(ptr, width, "%*s%c%s%c user      ",
                        pid_width-5+1, " ",
-                       active_col == -1 ? high_on : sep,
+                       active_col == -1 ? high_on : sep, id,
                        active_col == -1 ? high_off : sep);
   else
-    written = snprintf(ptr, width, "%*s%cPID%c",
+    written = snprintf(ptr, width, "%*s%c%s%c",
                        pid_width-5+1, " ",
-                       active_col == -1 ? high_on : sep,
+                       active_col == -1 ? high_on : sep, id,
                        active_col == -1 ? high_off : sep);
 
   ptr += written;
@@ -708,6 +742,146 @@ static void delete_columns (column_t* t, int nbc)
 }
 
 
+/* Navigate into expressions, and unmark the counters they use. */
+static void release_counters_used(expression* e, screen_t* s)
+{
+  if (e->type == ELEM && e->ele->type == COUNT) {
+    int found;
+
+    if (builtin_alias(e->ele->alias))
+      return;
+    found = find_counter(s, e->ele->alias);
+    if (found >= 0)
+      s->counters[found].used--;
+  }
+  else if (e->type == OPER && e->op != NULL) {
+    release_counters_used(e->op->exp1, s);
+    release_counters_used(e->op->exp2, s);
+  }
+}
+
+
+/* Generic hardware event 'name' (CPU_CYCLES...). They come first in
+   the table of predefined events, before the cache events. */
+static int generic_event(const char* name, uint64_t* config)
+{
+  int i;
+
+  for(i = 0; events[i].perf_hw_id != PERF_COUNT_HW_CACHE_L1D; i++) {
+    if (strcmp(name, events[i].name) == 0) {
+      *config = events[i].perf_hw_id;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+
+/* Declare in screen 's' the counters that expression 'e' uses and 's'
+   does not have: a counter of another screen with the same alias, or
+   a generic hardware event. Return -1 if one is unknown. */
+static int declare_counters_used(expression* e, screen_t* s)
+{
+  if (e->type == ELEM && e->ele->type == COUNT) {
+    const char* alias = e->ele->alias;
+    uint64_t    config;
+    int         i, found;
+
+    if (builtin_alias(alias) || (find_counter(s, alias) >= 0))
+      return 0;
+    for(i=0; i < num_screens; i++) {
+      found = find_counter(screens[i], alias);
+      if (found >= 0)
+        return add_counter_by_value(s, (char*)alias,
+                                    screens[i]->counters[found].config,
+                                    screens[i]->counters[found].type) < 0 ?
+               -1 : 0;
+    }
+    if (generic_event(alias, &config) == 0)
+      return add_counter_by_value(s, (char*)alias, config,
+                                  PERF_TYPE_HARDWARE) < 0 ? -1 : 0;
+    error_printf("Unknown counter '%s' in screen '%s'\n", alias, s->name);
+    return -1;
+  }
+  else if (e->type == OPER && e->op != NULL) {
+    if (declare_counters_used(e->op->exp1, s) == -1)
+      return -1;
+    return declare_counters_used(e->op->exp2, s);
+  }
+  return 0;
+}
+
+
+/* Delete the counters of 's' that no column uses. The others keep
+   their order. */
+static void delete_unused_counters(screen_t* const s)
+{
+  int i = 0;
+
+  while (i < s->num_counters) {
+    if (s->counters[i].used == 0)
+      delete_and_shift_counters(s, i);
+    else
+      i++;
+  }
+}
+
+
+/* Add a column to screen 's' while it is displayed, from 'spec':
+   "[header=]expression". The counters that the expression needs are
+   declared if necessary (see declare_counters_used), after the
+   existing ones, which keep their index. The caller must then open
+   the new counters on the tasks (see change_counters). Return the
+   index of the column, or -1. */
+int add_live_column(screen_t* const s, const char* spec)
+{
+  char        expr[100], header[11];
+  const char* eq = strchr(spec, '=');
+  expression* e;
+  int         n;
+
+  if (eq) {
+    const int len = (eq - spec < 10) ? (int)(eq - spec) : 10;
+    snprintf(expr, sizeof(expr), "%s", eq + 1);
+    snprintf(header, sizeof(header), "%10.*s", len, spec);
+  }
+  else {
+    snprintf(expr, sizeof(expr), "%s", spec);
+    snprintf(header, sizeof(header), "%10.10s", spec);
+  }
+
+  e = parser_expression(expr);
+  if (e == NULL || e->type == ERROR) {
+    free_expression(e);
+    error_printf("Invalid expression '%s'\n", expr);
+    return -1;
+  }
+  n = declare_counters_used(e, s);
+  free_expression(e);
+  if (n != -1)
+    n = add_column(s, header, "%10.4g", "(added in live mode)", expr);
+  if (n == -1)
+    delete_unused_counters(s);  /* declared for nothing */
+  return n;
+}
+
+
+/* Remove column 'col' of screen 's' while it is displayed, and the
+   counters that no other column uses. The caller must then close them
+   on the tasks (see change_counters). */
+void remove_column(screen_t* const s, int col)
+{
+  assert((col >= 0) && (col < s->num_columns));
+  release_counters_used(s->columns[col].expression, s);
+  delete_column(&s->columns[col]);
+  memmove(&s->columns[col], &s->columns[col + 1],
+          (s->num_columns - col - 1) * sizeof(column_t));
+  s->num_columns--;
+  compile_columns(s);
+  delete_unused_counters(s);
+}
+
+
 void delete_screen(screen_t* s)
 {
   assert(s);
@@ -715,6 +889,7 @@ void delete_screen(screen_t* s)
   free(s->desc);
   delete_counters(s->counters, s->num_counters);
   delete_columns(s->columns, s->num_columns);
+  free_program(s->program);
   free(s);
 }
 
@@ -24,6 +24,8 @@ typedef struct {
 } counter_t;
 
 
+struct program;
+
 typedef struct {
   char* header;
   char* format;  /* as in printf */
@@ -43,6 +45,7 @@ typedef struct {
   int        num_columns;
   int        num_alloc_columns;
   column_t*  columns;
+  struct program* program;  /* the columns, compiled together */
 } screen_t;
 
 
@@ -62,6 +65,10 @@ int add_column(screen_t* const s, char* header, char* format, char* desc,
 
 void tamp_counters(void);
 
+/* columns changed in live mode */
+int  add_live_column(screen_t* const s, const char* spec);
+void remove_column(screen_t* const s, int col);
+
 void init_screen(void);
 screen_t* get_screen(int);
 screen_t* get_screen_by_name(const char* name);
@@ -18,6 +18,8 @@
 #include <unistd.h>
 
 #include "options.h"
+#include "priv.h"
+#include "proc-events.h"
 #include "process.h"
 #include "spawn.h"
 
@@ -95,6 +97,7 @@ int spawn(char** argv)
     if (n != 1)
       fprintf(stderr, "Something went wrong with the command\n");
 
+    restore_files_limit();  /* raised for the counters of tiptop */
     if (execvp(argv[0], argv) == -1) {
       perror("execvp");
       exit(EXIT_FAILURE);
@@ -124,6 +127,10 @@ void start_child()
 
   close(pipefd[1]);
 
+  /* the kernel reports the exec, names will be updated then */
+  if (proc_events_active())
+    return;
+
   /* set timer, we need to update the name and command line of the new
      process in a little while */
   tv1.tv_sec = 0;
@@ -39,11 +39,13 @@
 #include "options.h"
 #include "pmc.h"
 #include "priv.h"
+#include "proc-events.h"
 #include "process.h"
 #include "requisite.h"
 #include "screen.h"
 #include "spawn.h"
 #include "utils-expression.h"
+#include "workers.h"
 
 struct option options;
 
@@ -136,12 +138,218 @@ static int cmp_string(const void* p1, const void* p2)
 }
 
 
+/* Move down the heap the entry at position 'i'. The root of the heap
+   is the entry that sorts last. */
+static void sift_down(struct process** heap, int num, int i)
+{
+  for(;;) {
+    int last = i;
+    const int l = 2 * i + 1;
+    const int r = l + 1;
+    struct process* tmp;
+
+    if ((l < num) && (sorting_fun(&heap[l], &heap[last]) > 0))
+      last = l;
+    if ((r < num) && (sorting_fun(&heap[r], &heap[last]) > 0))
+      last = r;
+    if (last == i)
+      return;
+    tmp = heap[i];
+    heap[i] = heap[last];
+    heap[last] = tmp;
+    i = last;
+  }
+}
+
+
+/* Select, in sorted order, the first 'k' tasks of the list that have a
+   row. Only the rows that fit on the screen are sorted: the candidates
+   go through a heap of 'k' entries, whose root is the one that sorts
+   last, then the heap is sorted. When most of the tasks are shown
+   anyway, they are simply all sorted. Return the number of rows. */
+static int top_rows(const struct process_list* const proc_list, int k,
+                    struct process*** rows)
+{
+  static struct process** heap = NULL;
+  static int num_alloc = 0;
+  struct process** const p = proc_list->proc_ptrs;
+  int i, num = 0;
+
+  if (k > proc_list->num_tids)
+    k = proc_list->num_tids;
+  if (k > num_alloc) {
+    num_alloc = k;
+    heap = realloc(heap, num_alloc * sizeof(struct process*));
+  }
+
+  if (4 * k >= proc_list->num_tids) {  /* few hidden, sort everything */
+    qsort(p, proc_list->num_tids, sizeof(struct process*), sorting_fun);
+    for(i=0; (i < proc_list->num_tids) && (num < k); i++) {
+      if (p[i]->skip || (!options.show_threads && (p[i]->pid != p[i]->tid)))
+        continue;
+      heap[num++] = p[i];
+    }
+    *rows = heap;
+    return num;
+  }
+
+  for(i=0; i < proc_list->num_tids; i++) {
+    if (p[i]->skip || (!options.show_threads && (p[i]->pid != p[i]->tid)))
+      continue;
+    if (num < k) {
+      heap[num++] = p[i];
+      if (num == k) {  /* full, heapify */
+        int j;
+        for(j = k / 2 - 1; j >= 0; j--)
+          sift_down(heap, k, j);
+      }
+    }
+    else if (sorting_fun(&p[i], &heap[0]) < 0) {
+      heap[0] = p[i];
+      sift_down(heap, k, 0);
+    }
+  }
+  qsort(heap, num, sizeof(struct process*), sorting_fun);
+  *rows = heap;
+  return num;
+}
+
+
+/* Entry of the sort of batch mode: the sort key is copied next to the
+   task, so that comparisons do not dereference the task. */
+struct sort_entry {
+  double key;
+  struct process* p;
+};
+
+static int sort_by_key;  /* 0: compare the names with sorting_fun */
+
+
+static inline int before(const struct sort_entry* a,
+                         const struct sort_entry* b)
+{
+  if (sort_by_key)
+    return a->key < b->key;
+  return sorting_fun(&a->p, &b->p) < 0;
+}
+
+
+/* Sort all the tasks of the list, in place. Between two refreshes, the
+   order changes little, and the list is still sorted from the previous
+   refresh: a natural merge sort finds the runs that are already in
+   order, and merges them. An unchanged order costs a single pass. The
+   sort is stable, tasks with the same key keep their relative order.
+   Names have no key to copy: unless already in order, they go through
+   qsort. */
+static void sort_rows(struct process_list* const proc_list)
+{
+  static struct sort_entry* e = NULL;
+  static struct sort_entry* tmp = NULL;
+  static int* runs = NULL;  /* start of each run, and end of the last */
+  static int num_alloc = 0;
+  struct process** const p = proc_list->proc_ptrs;
+  const int n = proc_list->num_tids;
+  const double sign = (sorting_order == DESCENDING) ? -1.0 : 1.0;
+  int i, num_runs;
+
+  if (n < 2)  /* already sorted, and nothing may be allocated yet */
+    return;
+
+  if (n > num_alloc) {
+    num_alloc = n;
+    e = realloc(e, num_alloc * sizeof(struct sort_entry));
+    tmp = realloc(tmp, num_alloc * sizeof(struct sort_entry));
+    runs = realloc(runs, (num_alloc + 1) * sizeof(int));
+  }
+
+  /* keys such that the first row has the smallest */
+  sort_by_key = (sorting_fun != cmp_string);
+  for(i = 0; i < n; i++) {
+    e[i].p = p[i];
+    if (sorting_fun == cmp_double)
+      e[i].key = sign * p[i]->u.d;
+    else if (sorting_fun == cmp_int)
+      e[i].key = sign * p[i]->u.i;
+  }
+
+  /* find the runs, reverse those strictly in the wrong order */
+  num_runs = 0;
+  for(i = 0; i < n; ) {
+    int j = i + 1;
+    runs[num_runs++] = i;
+    if ((j < n) && before(&e[j], &e[i])) {
+      int lo, hi;
+      while ((j + 1 < n) && before(&e[j + 1], &e[j]))
+        j++;
+      for(lo = i, hi = j; lo < hi; lo++, hi--) {
+        struct sort_entry t = e[lo];
+        e[lo] = e[hi];
+        e[hi] = t;
+      }
+      j++;
+    }
+    while ((j < n) && !before(&e[j], &e[j - 1]))
+      j++;
+    i = j;
+  }
+  runs[num_runs] = n;
+
+  /* without a key, merging is slower than qsort on the tasks */
+  if (!sort_by_key && (num_runs > 1)) {
+    qsort(p, n, sizeof(struct process*), sorting_fun);
+    return;
+  }
+
+  /* merge adjacent runs, until only one is left */
+  while (num_runs > 1) {
+    struct sort_entry* swap;
+    int r, k = 0;
+
+    for(r = 0; r < num_runs; r += 2) {
+      const int lo = runs[r];
+      int mid, hi, a, b, o;
+
+      runs[k++] = lo;
+      if (r + 1 == num_runs) {  /* odd one out */
+        memcpy(&tmp[lo], &e[lo], (n - lo) * sizeof(struct sort_entry));
+        break;
+      }
+      mid = runs[r + 1];
+      hi = runs[r + 2];
+      a = lo;
+      b = mid;
+      o = lo;
+      while ((a < mid) && (b < hi))
+        tmp[o++] = before(&e[b], &e[a]) ? e[b++] : e[a++];
+      memcpy(&tmp[o], &e[a], (mid - a) * sizeof(struct sort_entry));
+      o += mid - a;
+      memcpy(&tmp[o], &e[b], (hi - b) * sizeof(struct sort_entry));
+    }
+    runs[k] = n;
+    num_runs = k;
+    swap = e;
+    e = tmp;
+    tmp = swap;
+  }
+
+  for(i = 0; i < n; i++)
+    p[i] = e[i].p;
+}
+
+
 /* For each process/thread in the list, generate the text form, ready
  * to be printed.
  */
 static void build_rows(struct process_list* proc_list, screen_t* s, int width)
 {
+  static struct process** shown = NULL;  /* tasks with a row */
+  static int num_alloc_shown = 0;
+  static double* results = NULL;  /* num_shown values per column */
+  static char*   errors = NULL;
+  static int num_alloc_results = 0;
+  int num_shown;
   int row_width;
+  int col, i;
   struct process* p;
   assert(TXT_LEN > 20);
 
@@ -163,13 +371,9 @@ static void build_rows(struct process_list* proc_list, screen_t* s, int width)
   else
     sorting_fun = cmp_double;  /* (computed) expression */
 
-  /* For all processes/threads */
+  /* For all processes/threads, select those that are shown */
+  num_shown = 0;
   for(p = proc_list->processes; p; p = p->next) {
-    int   col, written;
-    char* row = p->txt;  /* the row we are building */
-    int   remaining = row_width;  /* remaining bytes in row */
-    int   thr = ' ';
-
     p->skip = 1;  /* first, assume not ready */
 
 
@@ -177,8 +381,10 @@ static void build_rows(struct process_list* proc_list, screen_t* s, int width)
     if ((p->dead) && (!options.sticky))
       continue;
 
-    /* not active, skip */
-    if (!options.idle && (p->cpu_percent < options.cpu_threshold))
+    /* not active, skip (all CPUs or cgroups are shown, they are not
+       tasks) */
+    if (!options.idle && !options.per_cpu && !options.cgroup_dir &&
+        (p->cpu_percent < options.cpu_threshold))
       continue;
 
     /* only some tasks are monitored, skip those that do not qualify */
@@ -190,10 +396,36 @@ static void build_rows(struct process_list* proc_list, screen_t* s, int width)
                                   !strstr(p->name, options.only_name)))
       continue;
 
+    if (num_shown == num_alloc_shown) {
+      num_alloc_shown = num_alloc_shown ? 2 * num_alloc_shown : 256;
+      shown = realloc(shown, num_alloc_shown * sizeof(struct process*));
+    }
+    shown[num_shown++] = p;
+  }
+
+  /* Evaluate the columns for all the selected tasks at once */
+  if (num_shown * s->num_columns > num_alloc_results) {
+    num_alloc_results = num_shown * s->num_columns;
+    results = realloc(results, num_alloc_results * sizeof(double));
+    errors = realloc(errors, num_alloc_results);
+  }
+  run_program(s->program, shown, num_shown, results, errors);
+
+  /* Build the rows */
+  for(i = 0; i < num_shown; i++) {
+    char* row;
+    int   remaining = row_width;  /* remaining bytes in row */
+    int   thr = ' ';
+    int   written;
+
+    p = shown[i];
+    row = p->txt;  /* the row we are building */
+
     if (active_col == -1)  /* column -1 is the PID */
       p->u.i = p->tid;
 
-    /* display a '+' or '-' sign after processes made of multiple threads */
+    /* display a '+' or '-' sign after processes made of multiple
+       threads, and a '~' when the values are only estimates */
     if (p->num_threads > 1) {
       if (p->tid == p->pid)
         thr = '+';
@@ -201,29 +433,28 @@ static void build_rows(struct process_list* proc_list, screen_t* s, int width)
         thr = '-';
     }
 
-    if (options.show_user)
-      written = snprintf(row, remaining, "%*d%c %-10s ", pid_width, p->tid, thr,
-                                                         p->username);
+    if (p->tid < 0)  /* total row of system-wide mode */
+      written = snprintf(row, remaining, "%*s%c ", pid_width, "-", thr);
     else
-      written = snprintf(row, remaining, "%*d%c ", pid_width, p->tid, thr);
+      written = snprintf(row, remaining, "%*d%c%c", pid_width, p->tid, thr,
+                         p->estimated ? '~' : ' ');
+    if (options.show_user && (written < remaining))
+      written += snprintf(row + written, remaining - written, "%-10s ",
+                          p->username);
     row += written;
     remaining -= written;
 
     for(col = 0; col < s->num_columns; col++) {
-      double res = 0;
-      int error = 0;  /* used to track error situations requiring an
-                         error_field (code 1) or an empty_field (code 2) */
+      const double res = results[col * num_shown + i];
+      /* error situations require an error_field (code 1) or an
+         empty_field (code 2) */
+      const int error = errors[col * num_shown + i];
       const char* const fmt = s->columns[col].format;
 
       /* zero the sorting field. The double '.d' is the longest field. */
       if (active_col == col)
         p->u.d = 0.0;
 
-      res = evaluate_column_expression(s->columns[col].expression,
-                                       s->counters,
-                                       s->num_counters,
-                                       p, &error);
-
       if (error == 1)
         written = snprintf(row, remaining, "%s", s->columns[col].error_field);
       else if (error == 2)
@@ -317,6 +548,7 @@ static void batch_mode(struct process_list* proc_list, screen_t* screen)
 
   fprintf(out, "delay: %.2f  idle: %d  threads: %d\n",
           options.delay, (int)options.idle, (int)options.show_threads);
+  fprintf(out, "files budget: %d\n", files_budget(NULL));
   if (options.watch_pid)
     fprintf(out, "watching pid %d\n", options.watch_pid);
   else if (options.watch_name)
@@ -357,7 +589,7 @@ static void batch_mode(struct process_list* proc_list, screen_t* screen)
     build_rows(proc_list, screen, -1);
 
     /* sort by %CPU */
-    qsort(p, proc_list->num_tids, sizeof(struct process*), sorting_fun);
+    sort_rows(proc_list);
 
     num_printed = 0;
     for(i=0; i < proc_list->num_tids; i++) {
@@ -370,7 +602,8 @@ static void batch_mode(struct process_list* proc_list, screen_t* screen)
           fprintf(out, "%6d ", num_iter);
         if (options.show_epoch)
           fprintf(out, "%10u ", epoch);
-        fprintf(out, "%s%s", p[i]->txt, p[i]->dead ? " DEAD" : "");
+        fprintf(out, "%s%s", p[i]->txt,
+                p[i]->dead ? " DEAD" : (p[i]->evicted ? " EVICTED" : ""));
 
         /* if the process is being watched */
         if ((p[i]->tid == options.watch_pid) ||
@@ -588,6 +821,57 @@ static int handle_key()
 }
 
 
+/* Counters of many new tasks are being attached: the first refresh
+   after a screen switch, or on a large system, can take a while. */
+static void show_attach_progress(int done, int total)
+{
+  mvprintw(2, 0, "Attaching counters: %d/%d tasks", done, total);
+  clrtoeol();
+  refresh();
+}
+
+
+/* Add a column from an expression typed by the user ('a'), or remove
+   the active column ('x'). The counters of the screen change
+   accordingly on the tasks, the others keep counting. Return -1 if
+   the list of tasks must be built again. */
+static int edit_columns(int c, struct process_list* proc_list,
+                        screen_t* screen)
+{
+  counter_t old[MAX_EVENTS];
+  int       num_old = screen->num_counters;
+
+  memcpy(old, screen->counters, num_old * sizeof(counter_t));
+
+  if (c == 'a') {
+    char str[100] = { 0 };  /* initialize string to 0s */
+    mvprintw(2, 0, "Add column ([header=]expression): ");
+    echo();
+    nocbreak();
+    getnstr(str, sizeof(str) - 1);  /* keep final '\0' as string delimiter */
+    cbreak();
+    noecho();
+    if (str[0] == '\0')
+      return 0;
+    if (add_live_column(screen, str) == -1) {
+      message = "Column not added (see errors).";
+      return 0;
+    }
+  }
+  else {
+    if ((active_col < 0) || (active_col >= screen->num_columns)) {
+      message = "Select a column of counters first (with < and >).";
+      return 0;
+    }
+    remove_column(screen, active_col);
+    if (active_col >= screen->num_columns)
+      active_col = screen->num_columns - 1;
+  }
+
+  return change_counters(proc_list, old, num_old, screen, &options);
+}
+
+
 /* Main execution loop in live mode. Builds the list of processes,
  * collects statistics, and prints using curses. Repeats after some
  * delay, also catching key presses.
@@ -607,6 +891,7 @@ static int live_mode(struct process_list* proc_list, screen_t* screen)
   cbreak();
   noecho();
   keypad(stdscr, TRUE);
+  set_attach_progress(show_attach_progress);
 
   /* Prepare help window */
   help_win = prepare_help_win(screen);
@@ -628,11 +913,20 @@ static int live_mode(struct process_list* proc_list, screen_t* screen)
   pos = screen_pos(screen);
 
   for(num_iter=0; !options.max_iter || num_iter<options.max_iter; num_iter++) {
-    int  i, zz, printed, num_fd, num_dead;
+    int  i, zz, printed, num_rows, num_fd, num_dead;
 
     /* print various info */
     erase();
     mvprintw(0, 0, "tiptop -");
+    {
+      /* after the title, if it ends before the leftmost flag, [conf] */
+      const int col = strlen("tiptop -") + 1;
+      char files[40];
+      int  used, budget = files_budget(&used);
+      int  len = snprintf(files, sizeof(files), "files: %d/%d", used, budget);
+      if (col + len < COLS - 60)
+        mvprintw(0, col, "%s", files);
+    }
 
     if ((num_errors() > 0) && (COLS >= 37))
       mvprintw(LINES-1, 30, "[errors]");
@@ -677,8 +971,6 @@ static int live_mode(struct process_list* proc_list, screen_t* screen)
     if (!options.show_threads)
       accumulate_stats(proc_list);
 
-    p = proc_list->proc_ptrs;
-
     /* prepare for select */
     FD_ZERO(&fds);
     FD_SET(STDIN_FILENO, &fds);
@@ -686,16 +978,13 @@ static int live_mode(struct process_list* proc_list, screen_t* screen)
     /* generate the text version of all rows */
     build_rows(proc_list, screen, COLS - 1);
 
-    /* sort by %CPU */
-    qsort(p, proc_list->num_tids, sizeof(struct process*), sorting_fun);
+    /* sort by %CPU, only the rows that fit at the bottom of window */
+    num_rows = top_rows(proc_list, (LINES - 5 > 1) ? LINES - 5 : 1, &p);
 
     printed = 0;
 
-    /* Iterate over all threads */
-    for(i=0; i < proc_list->num_tids; i++) {
-
-      if (p[i]->skip)
-        continue;
+    /* Iterate over the rows to print */
+    for(i=0; i < num_rows; i++) {
 
       /* highlight watched process, if any */
       if (with_colors) {
@@ -710,22 +999,19 @@ static int live_mode(struct process_list* proc_list, screen_t* screen)
           attron(COLOR_PAIR(1));
       }
 
-      if (options.show_threads || (p[i]->pid == p[i]->tid)) {
-        printw("%s\n", p[i]->txt);
-        printed++;
-      }
+      printw("%s\n", p[i]->txt);
+      printed++;
 
       if (with_colors)
         attroff(COLOR_PAIR(1));
-
-      if (printed >= LINES - 5)  /* stop printing at bottom of window */
-        break;
     }
 
     mvprintw(1, 0, "Tasks: %3d total, %3d displayed",
              proc_list->num_tids, printed);
     if (options.sticky)
       printw(", %3d dead", num_dead);
+    if (num_evicted_tasks())
+      printw(", %3d evicted", num_evicted_tasks());
 
     /* print the screen name, make sure it fits, or truncate */
     if (35 + 20 + 11 + strlen(screen->name) < COLS) {
@@ -783,12 +1069,12 @@ static int live_mode(struct process_list* proc_list, screen_t* screen)
         header = gen_header(screen, &options, COLS - 1, active_col, pid_width);
       }
       if (c == 'H') {
-        if (options.show_threads) {
-          reset_values(proc_list);
+        if (options.show_threads)
           message = "Show threads On";
-        }
         else
           message = "Show threads Off";
+        /* switching between per-thread and per-process counters */
+        return c;
       }
       if (c == 'U') {
         free(header);
@@ -797,9 +1083,22 @@ static int live_mode(struct process_list* proc_list, screen_t* screen)
       if ((c == '+') || (c == '-') || (c == KEY_LEFT) || (c == KEY_RIGHT))
         return c;
 
-      if ((c == 'u') || (c == 'K') || (c == 'p')) /* need to rebuild tasks list */
+      if (c == 'K')  /* need to open the counters again */
         return c;
 
+      if ((c == 'a') || (c == 'x')) {
+        if (edit_columns(c, proc_list, screen) == -1)
+          return c;
+        free(header);
+        header = gen_header(screen, &options, COLS - 1, active_col, pid_width);
+        delwin(help_win);
+        help_win = prepare_help_win(screen);
+      }
+
+      /* processes filtered out may qualify now */
+      if ((c == 'p') || ((c == 'c') && options.only_name))
+        rescan_proc_list(proc_list);
+
       if (c == 'e') {
         if (options.error > 0) {
           options.error = 0;
@@ -818,6 +1117,7 @@ static int live_mode(struct process_list* proc_list, screen_t* screen)
 
   delwin(help_win);
 
+  set_attach_progress(NULL);
   endwin();  /* stop curses */
   return 'q';
 }
@@ -844,6 +1144,9 @@ int main(int argc, char* argv[])
   /* then, drop super powers, if any. */
   euid = init_drop_privilege();
 
+  /* each counter is a file, allow as many as possible */
+  raise_files_limit();
+
   init_options(&options);
   options.paranoia_level = paranoia_level;
 
@@ -883,6 +1186,9 @@ int main(int argc, char* argv[])
     fclose(f_pid_max);
   }
 
+  /* start the helper threads, if requested */
+  workers_init(options.num_jobs);
+
   /* Add default screens */
   if (options.default_screen == 1)
     init_screen();
@@ -903,7 +1209,13 @@ int main(int argc, char* argv[])
     options.idle = 1;
   }
 
+  proc_list = NULL;
   do {
+    /* with a new kernel mode, or columns edited in system-wide mode,
+       no counter can be kept */
+    const screen_t* prev_screen =
+      ((key == 'K') || (key == 'a') || (key == 'x')) ? NULL : screen;
+
     if (screen_num >= 0)
       screen = get_screen(screen_num);
     else
@@ -914,8 +1226,17 @@ int main(int argc, char* argv[])
       exit(EXIT_FAILURE);
     }
 
+    /* keep the tasks and their counters across screens, unless the
+       rows change */
+    if (proc_list &&
+        (switch_counters(proc_list, prev_screen, screen, &options) == -1)) {
+      done_proc_list(proc_list);
+      proc_list = NULL;
+    }
+
     /* initialize the list of processes, and then run */
-    proc_list = init_proc_list();
+    if (!proc_list)
+      proc_list = init_proc_list(&options);
 
     if (options.spawn_pos) {
       options.spawn_pos = 0;  /* do this only once */
@@ -933,19 +1254,14 @@ int main(int argc, char* argv[])
       if ((key == '+')  || (key == KEY_RIGHT)) {
         screen_num = (screen_num + 1) % get_num_screens();
         active_col = 0;
-        done_proc_list(proc_list);
         free(header);
       }
       if ((key == '-') || (key == KEY_LEFT)) {
         int n = get_num_screens();
         screen_num = (screen_num + n - 1) % n;
         active_col = 0;
-        done_proc_list(proc_list);
         free(header);
       }
-      if ((key == 'u') || (key == 'K') || (key == 'p')) {
-        done_proc_list(proc_list);
-      }
     }
 #endif
   } while (key != 'q');
@@ -954,6 +1270,8 @@ int main(int argc, char* argv[])
   close_error();
   delete_screens();
   done_proc_list(proc_list);
+  proc_events_fini();
+  workers_fini();
   free_options(&options);
   return 0;
 }
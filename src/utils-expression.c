@@ -20,29 +20,14 @@
 #include "utils-expression.h"
 
 
-/* copy of the expression found in XML file. To be passed to the lexer
-   (possibly in chunks) by my_yyinput. */
-static char* ptr_myinput = NULL;
-
-/* Expression built by parser, */
-expression* res_expr = NULL;
-
-void yyparse();  /* generated by yacc */
+/* scanner of calc-lex.c, and parser generated by yacc, reentrant */
+void* calc_scanner_new(const char* txt);
+void  calc_scanner_free(void* scanner);
+int   yyparse(void* scanner, expression** result);
 
 
 /* dedicated tools to allocate expression and son */
 
-int my_yyinput(char* buffer, int buffer_size)
-{
-  int len;
-
-  strncpy(buffer, ptr_myinput, buffer_size);
-  len = strlen(buffer);
-  ptr_myinput += len;
-  return len;
-}
-
-
 unit* alloc_unit()
 {
   unit* u = malloc(sizeof(unit));
@@ -104,6 +89,24 @@ void free_operation(operation* p)
 }
 
 
+/* Name of the function over time that 'o' is, or NULL for an operator
+   (see build_node_function in calc.y). */
+static const char* function_name(const operation* o)
+{
+  switch(o->operator) {
+  case 'e':
+    return "ewma";
+  case 'm':
+    return "wmin";
+  case 'M':
+    return "wmax";
+  case 'a':
+    return "wavg";
+  }
+  return NULL;
+}
+
+
 #ifdef ENABLE_DEBUG
 /* Print an expression */
 void print_expression(expression* e)
@@ -116,6 +119,8 @@ void print_expression(expression* e)
     if (e->ele->type == COUNT) {
       if (e->ele->delta == DELT)
         printf("delta(%s)", e->ele->alias);
+      else if (e->ele->delta == PERSEC)
+        printf("rate(%s)", e->ele->alias);
       else
         printf("%s", e->ele->alias);
     }
@@ -123,6 +128,11 @@ void print_expression(expression* e)
       printf("%2.1f", e->ele->val);
     }
   }
+  else if (e->type == OPER && e->op != NULL && function_name(e->op)) {
+    printf("%s(", function_name(e->op));
+    print_expression(e->op->exp1);
+    printf(", %g)", e->op->exp2->ele->val);
+  }
   else if (e->type == OPER && e->op != NULL) {
     printf("(");
     print_expression(e->op->exp1);
@@ -141,12 +151,21 @@ int build_expression(expression* e, FILE* fd)
     if (e->ele->type == COUNT) {
       if (e->ele->delta == DELT)
         return fprintf(fd, "delta(%s)", e->ele->alias);
+      else if (e->ele->delta == PERSEC)
+        return fprintf(fd, "rate(%s)", e->ele->alias);
       else
         return fprintf(fd, "%s", e->ele->alias);
     }
     else if (e->ele->type == CONST)
       return fprintf(fd, "%4.2lf", e->ele->val);
   }
+  else if (e->type == OPER && e->op != NULL && function_name(e->op)) {
+    if (fprintf(fd, "%s(", function_name(e->op)) < 0)
+      return -1;
+    if (build_expression(e->op->exp1, fd) < 0)
+      return -1;
+    return fprintf(fd, ", %g)", e->op->exp2->ele->val);
+  }
   else if (e->type == OPER && e->op != NULL) {
     if (fprintf(fd, "(") < 0)
       return -1;
@@ -182,13 +201,24 @@ int build_expression(expression* e, FILE* fd)
 }
 
 
-/* Parse and return a representative tree */
+/* Parse and return a representative tree. The state of the scanner
+   and of the parser is local to each call: expressions can be parsed
+   by several threads at once. */
 expression* parser_expression(char* txt)
 {
-  ptr_myinput = txt;
-  res_expr = NULL;  /* will be computed by yacc-generated parser */
+  expression* res_expr = NULL;  /* will be computed by yacc-generated
+                                   parser */
+  void* scanner;
+
   if (strlen(txt) > 0) {
-    yyparse();
+    scanner = calc_scanner_new(txt);
+    /* on a syntax error, a default reduction may already have set
+       the result to the beginning of the expression */
+    if (yyparse(scanner, &res_expr) != 0) {
+      free_expression(res_expr);
+      res_expr = NULL;
+    }
+    calc_scanner_free(scanner);
   }
   return res_expr;
 }
@@ -205,105 +235,474 @@ static int get_counter_id(char* alias, counter_t* tab, int nbc)
 }
 
 
-/* Tools to get counter value */
-static double get_counter_value(unit* e, counter_t* tab, int nbc, char delta,
-                                struct process* p, int* error)
+/* Compiled column expressions.
+
+   The expressions of all the columns of a screen are compiled together
+   into a program: a DAG of nodes, in evaluation order, where identical
+   subexpressions are interned, so that a term used by several columns
+   (delta(CYCLE)...) is computed once per task. Subtrees made of
+   constants are folded at compile time. The aliases are resolved too:
+   counters become their index in the screen, the system values
+   (CPU_TOT...) have their own opcode. Evaluation then depends neither
+   on the length of the aliases, nor on the number of counters.
+
+   The program is run over PROGRAM_LANES tasks at a time, each node
+   holding one value per task. Operands are gathered from the tasks,
+   then each node is a loop over the lanes, without branches, that the
+   compiler turns into SIMD code. Constant nodes are filled once, at
+   compile time.
+
+   Errors are tracked per lane: 1 for an invalid counter, 2 for a
+   division by zero. A node has the error of its first operand, then
+   of its second, then its own, as if evaluation stopped at the first
+   error.
+
+   The functions over time (ewma, wmin, wmax, wavg) keep a state per
+   task, in its history: 2 doubles for ewma (average, and whether it
+   has a value), 2 + n for a window of n samples (ring buffer, with its
+   head and its number of samples). Only the tasks of a screen that
+   uses them have a history. It is reset when the program changes
+   (screen switch, column added...). Each sample of a task enters the
+   history once, even if the rows are built several times per refresh.
+   A sample where the argument is in error is not accounted, and the
+   result shows the error.
+
+   The values of the nodes are stored in the program: it cannot be run
+   by two threads at once.
+ */
+
+static unsigned int last_program_id = 0;
+
+/* Add node 'n' to 'prog', unless it already has the same one. Return
+   its index. */
+static int intern(struct program* prog, const struct node* n)
+{
+  int i;
+
+  for(i = 0; i < prog->num_nodes; i++) {
+    const struct node* const m = &prog->nodes[i];
+
+    if ((m->op == n->op) && (m->slot == n->slot) &&
+        (m->a == n->a) && (m->b == n->b) && (m->val == n->val))
+      return i;
+  }
+  if (prog->num_nodes == prog->alloc_nodes) {
+    prog->alloc_nodes = prog->alloc_nodes ? 2 * prog->alloc_nodes : 16;
+    prog->nodes = realloc(prog->nodes,
+                          prog->alloc_nodes * sizeof(struct node));
+  }
+  prog->nodes[prog->num_nodes] = *n;
+  return prog->num_nodes++;
+}
+
+
+static int alias_opcode(const char* alias)
 {
-  int id;
-  /* System information: not based on performances counters */
-  if (strcmp(e->alias, "CPU_TOT") == 0)
-    return p->cpu_percent;
+  if (strcmp(alias, "CPU_TOT") == 0)
+    return OP_CPU_TOT;
+  if (strcmp(alias, "CPU_SYS") == 0)
+    return OP_CPU_SYS;
+  if (strcmp(alias, "CPU_USER") == 0)
+    return OP_CPU_USER;
+  if (strcmp(alias, "RUN_RATIO") == 0)
+    return OP_RUN_RATIO;
+  if (strcmp(alias, "PROC_ID") == 0)
+    return OP_PROC_ID;
+  return -1;
+}
 
-  if (strcmp(e->alias, "CPU_SYS") == 0)
-    return p->cpu_percent_s;
 
-  if (strcmp(e->alias, "CPU_USER") == 0)
-    return p->cpu_percent_u;
+/* Compile 'e', return the index of its node. */
+static int compile_node(expression* e, const screen_t* s,
+                        struct program* prog)
+{
+  struct node n = { OP_CONST, -1, -1, -1, -1, 0 };
+  const struct node* a;
+  const struct node* b;
+  int k;
 
-  if (strcmp(e->alias, "PROC_ID") == 0) {
-    if (p->proc_id != -1) {
-      return (double)p->proc_id;
+  if (e == NULL) {
+    n.op = OP_INVALID;
+    return intern(prog, &n);
+  }
+  if ((e->type == ELEM) && (e->ele->type == COUNT)) {
+    n.op = alias_opcode(e->ele->alias);
+    if (n.op == -1) {
+      n.slot = get_counter_id(e->ele->alias, s->counters, s->num_counters);
+      if (n.slot == -1)
+        n.op = OP_INVALID;
+      else if (e->ele->delta == DELT)
+        n.op = OP_DELTA;
+      else if (e->ele->delta == PERSEC)
+        n.op = OP_RATE;
+      else
+        n.op = OP_VALUE;
+    }
+    return intern(prog, &n);
+  }
+  if ((e->type == ELEM) && (e->ele->type == CONST)) {
+    n.val = e->ele->val;
+    return intern(prog, &n);
+  }
+  if ((e->type != OPER) || (e->op == NULL))
+    return intern(prog, &n);  /* evaluates to 0, as the tree walker */
+
+  n.a = compile_node(e->op->exp1, s, prog);
+  if (function_name(e->op)) {
+    switch(e->op->operator) {
+    case 'e':
+      n.op = OP_EWMA;
+      break;
+    case 'm':
+      n.op = OP_WMIN;
+      break;
+    case 'M':
+      n.op = OP_WMAX;
+      break;
+    case 'a':
+      n.op = OP_WAVG;
+      break;
     }
-    else {
-      *error=1;
-      return 1;
+    n.val = e->op->exp2->ele->val;  /* weight, or size of the window */
+    k = intern(prog, &n);
+    if (prog->nodes[k].state == -1) {  /* new one */
+      prog->nodes[k].state = prog->history_size;
+      prog->history_size += 2 + ((n.op == OP_EWMA) ? 0 : (int)n.val);
     }
+    return k;
   }
-  id = get_counter_id(e->alias, tab, nbc);
 
-  if ((id == -1) || (p->values[id] == 0xffffffff)) {
-    /* Invalid counter */
-    *error = 1;
-    return 1;
+  n.b = compile_node(e->op->exp2, s, prog);
+  switch(e->op->operator) {
+  case '+':
+    n.op = OP_ADD;
+    break;
+  case '-':
+    n.op = OP_SUB;
+    break;
+  case '*':
+    n.op = OP_MUL;
+    break;
+  case '/':
+    n.op = OP_DIV;
+    break;
+  default:
+    /* Unknown operator */
+    assert(0);
   }
 
-  if (delta == DELT)
-    return (double) (p->values[id] - p->prev_values[id]);
+  /* fold constants, but leave divisions by 0 to the error path */
+  a = &prog->nodes[n.a];
+  b = &prog->nodes[n.b];
+  if ((a->op == OP_CONST) && (b->op == OP_CONST) &&
+      ((n.op != OP_DIV) || (b->val != 0))) {
+    switch(n.op) {
+    case OP_ADD:
+      n.val = a->val + b->val;
+      break;
+    case OP_SUB:
+      n.val = a->val - b->val;
+      break;
+    case OP_MUL:
+      n.val = a->val * b->val;
+      break;
+    case OP_DIV:
+      n.val = a->val / b->val;
+      break;
+    }
+    n.op = OP_CONST;
+    n.a = n.b = -1;
+  }
+  return intern(prog, &n);
+}
 
-  return (double) p->values[id];
+
+/* Compile the expressions of all the columns of screen 's', with its
+   current counters. */
+struct program* compile_screen(const screen_t* s)
+{
+  struct program* prog = malloc(sizeof(struct program));
+  int i, j;
+
+  prog->nodes = NULL;
+  prog->num_nodes = 0;
+  prog->alloc_nodes = 0;
+  prog->history_size = 0;
+  prog->id = __sync_add_and_fetch(&last_program_id, 1);
+  prog->num_outputs = s->num_columns;
+  prog->outputs = malloc(s->num_columns * sizeof(int) + 1);
+  for(i = 0; i < s->num_columns; i++)
+    prog->outputs[i] = compile_node(s->columns[i].expression, s, prog);
+
+  prog->regs = malloc(prog->num_nodes * PROGRAM_LANES * sizeof(double) + 1);
+  prog->errs = malloc(prog->num_nodes * PROGRAM_LANES * sizeof(double) + 1);
+  for(i = 0; i < prog->num_nodes; i++) {
+    const struct node* const n = &prog->nodes[i];
+
+    if ((n->op != OP_CONST) && (n->op != OP_INVALID))
+      continue;
+    for(j = 0; j < PROGRAM_LANES; j++) {
+      prog->regs[i * PROGRAM_LANES + j] = n->val;
+      prog->errs[i * PROGRAM_LANES + j] = (n->op == OP_INVALID);
+    }
+  }
+  return prog;
 }
 
 
-/* Calculous and return result of expression gived in entry
- *
- * (argument error is used for indicate and determine which kind of
- * error appear during evaulation:
- *      1 => Invalid Counter
- *      2 => Divide per zero (also if it is double)
- */
+void free_program(struct program* prog)
+{
+  if (prog == NULL)
+    return;
+  free(prog->nodes);
+  free(prog->outputs);
+  free(prog->regs);
+  free(prog->errs);
+  free(prog);
+}
 
 
-double evaluate_column_expression(expression* e, counter_t* c, int nbc,
-                           struct process* p, int* error)
+/* On x86-64, the operators are compiled for AVX2 and for the baseline
+   (SSE2), the version is selected at load time. */
+#if defined(__x86_64__) && defined(__GNUC__) && (__GNUC__ >= 6) && \
+    !defined(__clang__)
+#define VECTOR_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define VECTOR_CLONES
+#endif
+
+/* error code e1 if any, else e2, without a branch */
+#define FIRST_ERROR(e1, e2)  ((e1) + ((e1) == 0) * (e2))
+
+/* out = a op b, on all the lanes */
+VECTOR_CLONES
+static void binary(int op, double* restrict out, double* restrict err,
+                   const double* restrict a, const double* restrict b,
+                   const double* restrict ea, const double* restrict eb)
 {
-  /* Invalid Expression */
-  if (e == NULL) {
-    *error = 1;
+  int i;
+
+  switch(op) {
+  case OP_ADD:
+    for(i = 0; i < PROGRAM_LANES; i++) {
+      err[i] = FIRST_ERROR(ea[i], eb[i]);
+      out[i] = a[i] + b[i];
+    }
+    break;
+  case OP_SUB:
+    for(i = 0; i < PROGRAM_LANES; i++) {
+      err[i] = FIRST_ERROR(ea[i], eb[i]);
+      out[i] = a[i] - b[i];
+    }
+    break;
+  case OP_MUL:
+    for(i = 0; i < PROGRAM_LANES; i++) {
+      err[i] = FIRST_ERROR(ea[i], eb[i]);
+      out[i] = a[i] * b[i];
+    }
+    break;
+  case OP_DIV:
+    for(i = 0; i < PROGRAM_LANES; i++) {
+      const double zero = (b[i] == 0);
+      const double e = FIRST_ERROR(ea[i], eb[i]);
+
+      err[i] = e + ((e == 0) & (b[i] == 0)) * 2;
+      out[i] = a[i] / (b[i] + zero);  /* divide by 1 instead of 0 */
+    }
+    break;
+  }
+}
+
+
+/* Make sure that 'p' has a history for 'prog'. Return 1 if its last
+   sample is not accounted in it yet, and mark it accounted. */
+static int new_sample(struct process* const p, const struct program* prog)
+{
+  if (p->history_id != prog->id) {
+    p->history = realloc(p->history, prog->history_size * sizeof(double));
+    memset(p->history, 0, prog->history_size * sizeof(double));
+    p->history_id = prog->id;
+  }
+  else if ((p->history_stamp.tv_sec == p->timestamp.tv_sec) &&
+           (p->history_stamp.tv_usec == p->timestamp.tv_usec))
     return 0;
+  p->history_stamp = p->timestamp;
+  return 1;
+}
+
+
+/* Function over time 'node' of 'x', with its 'state' in the history
+   of a task. The value is accounted if the sample is 'fresh'. */
+static double over_time(const struct node* const node, double* const state,
+                        double x, int fresh)
+{
+  double* const ring = state + 2;
+  double res;
+  int    i, count;
+
+  if (node->op == OP_EWMA) {
+    if (fresh) {
+      state[0] = state[1] ? node->val * x + (1 - node->val) * state[0] : x;
+      state[1] = 1;
+    }
+    return state[0];
   }
-  *error = 0;
-  if (e->type == ELEM) {
-    /* Return Element value */
-    if (e->ele->type == COUNT)
-      return get_counter_value(e->ele, c, nbc, e->ele->delta, p, error);
-    else if(e->ele->type == CONST)
-      return e->ele->val;
+
+  if (fresh) {
+    const int size = (int)node->val;
+
+    ring[(int)state[0]] = x;
+    state[0] = ((int)state[0] + 1) % size;
+    if (state[1] < size)
+      state[1]++;
   }
-  else if ((e->type == OPER) && (e->op != NULL)) {
-    /* Or calcul leaf value and return the result */
-    switch(e->op->operator) {
-    case '+':
-      return evaluate_column_expression(e->op->exp1, c, nbc, p, error) +
-             evaluate_column_expression(e->op->exp2, c, nbc, p, error);
-      break;
+  count = (int)state[1];  /* the samples are in ring[0..count-1] */
+  if (count == 0)
+    return x;
+  res = ring[0];
+  for(i = 1; i < count; i++) {
+    if (node->op == OP_WMIN)
+      res = (ring[i] < res) ? ring[i] : res;
+    else if (node->op == OP_WMAX)
+      res = (ring[i] > res) ? ring[i] : res;
+    else
+      res += ring[i];
+  }
+  return (node->op == OP_WAVG) ? res / count : res;
+}
 
-    case '-':
-      return evaluate_column_expression(e->op->exp1, c, nbc, p, error) -
-             evaluate_column_expression(e->op->exp2, c, nbc, p, error);
-      break;
 
-    case '*':
-      return evaluate_column_expression(e->op->exp1, c, nbc, p, error) *
-             evaluate_column_expression(e->op->exp2, c, nbc, p, error);
+static void run_lanes(const struct program* prog,
+                      struct process* const* tasks, int n,
+                      double* res, char* error, int stride)
+{
+  char fresh[PROGRAM_LANES];
+  int  i, k;
+
+  if (prog->history_size)
+    for(i = 0; i < n; i++)
+      fresh[i] = new_sample(tasks[i], prog);
+
+  for(k = 0; k < prog->num_nodes; k++) {
+    const struct node* const node = &prog->nodes[k];
+    double* const out = &prog->regs[k * PROGRAM_LANES];
+    double* const err = &prog->errs[k * PROGRAM_LANES];
+
+    switch(node->op) {
+    case OP_CONST:
+    case OP_INVALID:
+      continue;  /* filled by compile_screen */
+    case OP_VALUE:
+    case OP_DELTA:
+      for(i = 0; i < n; i++) {
+        const uint64_t v = tasks[i]->values[node->slot];
+
+        err[i] = (v == 0xffffffff);
+        out[i] = (double)(node->op == OP_DELTA ?
+                          v - tasks[i]->prev_values[node->slot] : v);
+      }
+      break;
+    case OP_RATE:
+      for(i = 0; i < n; i++) {
+        const uint64_t v = tasks[i]->values[node->slot];
+        const double   t = tasks[i]->interval;
+
+        err[i] = (v == 0xffffffff) ? 1 : ((t <= 0) ? 2 : 0);
+        out[i] = (double)(v - tasks[i]->prev_values[node->slot]) /
+                 ((t <= 0) ? 1 : t);
+      }
+      break;
+    case OP_CPU_TOT:
+      for(i = 0; i < n; i++) {
+        err[i] = 0;
+        out[i] = tasks[i]->cpu_percent;
+      }
+      break;
+    case OP_CPU_SYS:
+      for(i = 0; i < n; i++) {
+        err[i] = 0;
+        out[i] = tasks[i]->cpu_percent_s;
+      }
+      break;
+    case OP_CPU_USER:
+      for(i = 0; i < n; i++) {
+        err[i] = 0;
+        out[i] = tasks[i]->cpu_percent_u;
+      }
+      break;
+    case OP_RUN_RATIO:
+      for(i = 0; i < n; i++) {
+        err[i] = (tasks[i]->run_ratio < 0);
+        out[i] = tasks[i]->run_ratio;
+      }
+      break;
+    case OP_PROC_ID:
+      for(i = 0; i < n; i++) {
+        err[i] = (tasks[i]->proc_id == -1);
+        out[i] = (double)tasks[i]->proc_id;
+      }
       break;
-    case '/': {
-      double tmp = evaluate_column_expression(e->op->exp2, c, nbc, p, error);
-      if (tmp == 0) {
-        /* Divide by 0 */
-        *error = 2;
-        return 0;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+      binary(node->op, out, err,
+             &prog->regs[node->a * PROGRAM_LANES],
+             &prog->regs[node->b * PROGRAM_LANES],
+             &prog->errs[node->a * PROGRAM_LANES],
+             &prog->errs[node->b * PROGRAM_LANES]);
+      continue;
+    case OP_EWMA:
+    case OP_WMIN:
+    case OP_WMAX:
+    case OP_WAVG: {
+      const double* const x = &prog->regs[node->a * PROGRAM_LANES];
+      const double* const ex = &prog->errs[node->a * PROGRAM_LANES];
+
+      for(i = 0; i < n; i++) {
+        err[i] = ex[i];
+        out[i] = ex[i] ? x[i] :
+                 over_time(node, tasks[i]->history + node->state, x[i],
+                           fresh[i]);
       }
-      return evaluate_column_expression(e->op->exp1, c, nbc, p, error) / tmp;
       break;
     }
     default:
-      /* Unknown operator */
       assert(0);
     }
+    /* the lanes past n do not hold a task, keep them defined */
+    for(i = n; i < PROGRAM_LANES; i++)
+      out[i] = err[i] = 0;
+  }
+
+  for(k = 0; k < prog->num_outputs; k++) {
+    const double* const out = &prog->regs[prog->outputs[k] * PROGRAM_LANES];
+    const double* const err = &prog->errs[prog->outputs[k] * PROGRAM_LANES];
+
+    for(i = 0; i < n; i++) {
+      error[k * stride + i] = err[i];
+      res[k * stride + i] = (err[i] == 0) ? out[i] : (err[i] == 1);
+    }
   }
-  return 0;
 }
 
+
+/* Evaluate all the columns of 'prog' for the 'n' tasks of 'tasks'.
+   The result of column c for task i is stored in res[c * n + i], its
+   error code (0, 1 or 2) in error[c * n + i]. */
+void run_program(const struct program* prog,
+                 struct process* const* tasks, int n,
+                 double* res, char* error)
+{
+  int i;
+
+  for(i = 0; i < n; i += PROGRAM_LANES)
+    run_lanes(prog, tasks + i,
+              (n - i < PROGRAM_LANES) ? n - i : PROGRAM_LANES,
+              res + i, error + i, n);
+}
+
+
 uint64_t evaluate_counter_expression(expression* e, int* error)
 {
   uint64_t val = 0;
@@ -32,8 +32,58 @@ int build_expression(expression* e, FILE* fd);
 
 expression* parser_expression (char* txt);
 
-double evaluate_column_expression(expression* e, counter_t* c, int nbc,
-                           struct process* p, int* error);
 uint64_t evaluate_counter_expression(expression* e, int* error);
 
+
+/* Columns of a screen compiled into a DAG of nodes */
+enum {
+  OP_CONST,      /* val */
+  OP_VALUE,      /* values[slot] */
+  OP_DELTA,      /* values[slot] - prev_values[slot] */
+  OP_RATE,       /* delta per second */
+  OP_CPU_TOT,
+  OP_CPU_SYS,
+  OP_CPU_USER,
+  OP_RUN_RATIO,
+  OP_PROC_ID,
+  OP_INVALID,    /* unknown counter: error 1 */
+  OP_ADD,        /* a + b */
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_EWMA,       /* of a, val is the weight of the new value */
+  OP_WMIN,       /* of a, over the last val samples */
+  OP_WMAX,
+  OP_WAVG
+};
+
+#define PROGRAM_LANES 64  /* tasks evaluated together */
+#define WINDOW_MAX   256  /* samples kept by wmin, wmax and wavg */
+
+struct node {
+  int    op;
+  int    slot;   /* index of the counter in the screen */
+  int    a, b;   /* operands, earlier nodes */
+  int    state;  /* functions over time: offset in the history */
+  double val;
+};
+
+struct program {
+  struct node* nodes;  /* in evaluation order */
+  int     num_nodes;
+  int     alloc_nodes;
+  int*    outputs;  /* node of each column */
+  int     num_outputs;
+  double* regs;  /* PROGRAM_LANES values per node */
+  double* errs;  /* and their error codes */
+  int     history_size;  /* doubles of history per task, 0 if none */
+  unsigned int id;       /* unique, identifies the layout of history */
+};
+
+struct program* compile_screen(const screen_t* s);
+void free_program(struct program* prog);
+void run_program(const struct program* prog,
+                 struct process* const* tasks, int n,
+                 double* res, char* error);
+
 #endif  /* _UTILS_EXPRESSION_H */
@@ -0,0 +1,207 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Small pool of worker threads for the sampling pass.
+
+   The items (tasks) are split in contiguous chunks, one per job. The
+   calling thread processes the first chunk itself, helper threads the
+   other ones, and workers_run returns only when all chunks are done.
+   Each item is touched by exactly one job, whatever the number of
+   jobs: the outcome does not depend on the scheduling.
+
+   Helper threads block all signals: SIGALRM and SIGCHLD must
+   interrupt the main thread (see tiptop.c and spawn.c).
+ */
+
+#include <config.h>
+
+#include <signal.h>
+#include <stdlib.h>
+
+#include "debug.h"
+#include "workers.h"
+
+/* Below this number of items per job, the synchronization costs more
+   than it saves. */
+#define MIN_ITEMS_PER_JOB 64
+
+static int num_jobs = 1;
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+
+static pthread_t*     threads = NULL;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  done_cond = PTHREAD_COND_INITIALIZER;
+
+/* current batch of work, protected by 'lock' */
+static work_fun_t cur_fun;
+static void*      cur_arg;
+static int        cur_items;
+static int        cur_chunks;     /* number of jobs used for this batch */
+static unsigned   generation = 0; /* incremented for each batch */
+static int        pending = 0;    /* chunks not completed yet */
+static int        quit = 0;
+
+
+static void chunk_bounds(int chunk, int chunks, int items,
+                         int* first, int* last)
+{
+  *first = (int)((long)items * chunk / chunks);
+  *last  = (int)((long)items * (chunk + 1) / chunks);
+}
+
+
+static void* worker_main(void* arg)
+{
+  int      id = (int)(long)arg;  /* chunk number, 1 to num_jobs - 1 */
+  unsigned seen = 0;
+
+  pthread_mutex_lock(&lock);
+  for(;;) {
+    int first, last;
+
+    while ((generation == seen) && !quit)
+      pthread_cond_wait(&start_cond, &lock);
+    if (quit)
+      break;
+    seen = generation;
+    if (id >= cur_chunks)  /* small batch, not needed this time */
+      continue;
+
+    chunk_bounds(id, cur_chunks, cur_items, &first, &last);
+    pthread_mutex_unlock(&lock);
+
+    cur_fun(cur_arg, first, last);
+
+    pthread_mutex_lock(&lock);
+    if (--pending == 0)
+      pthread_cond_signal(&done_cond);
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+
+/* Start the pool. 'num_jobs' counts the calling thread: no thread is
+   created for 1 job. Return the number of jobs actually available. */
+int workers_init(int jobs)
+{
+  sigset_t all, old;
+  int i;
+
+  if ((jobs <= 1) || threads)
+    return num_jobs;
+
+  threads = malloc((jobs - 1) * sizeof(pthread_t));
+  if (!threads)
+    return num_jobs;
+
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);  /* inherited by helpers */
+  for(i = 1; i < jobs; i++) {
+    if (pthread_create(&threads[i - 1], NULL, worker_main, (void*)(long)i))
+      break;
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  num_jobs = i;
+  if (num_jobs == 1) {
+    free(threads);
+    threads = NULL;
+  }
+  debug_printf("Worker pool: %d job(s)\n", num_jobs);
+  return num_jobs;
+}
+
+
+/* Run 'fun' on [0, num_items), split across the jobs, and wait for
+   completion. */
+void workers_run(work_fun_t fun, void* arg, int num_items)
+{
+  int chunks = num_jobs;
+  int first, last;
+
+  if (num_items < chunks * MIN_ITEMS_PER_JOB)
+    chunks = num_items / MIN_ITEMS_PER_JOB;
+
+  if (chunks <= 1) {
+    fun(arg, 0, num_items);
+    return;
+  }
+
+  pthread_mutex_lock(&lock);
+  cur_fun = fun;
+  cur_arg = arg;
+  cur_items = num_items;
+  cur_chunks = chunks;
+  pending = chunks - 1;
+  generation++;
+  pthread_cond_broadcast(&start_cond);
+  pthread_mutex_unlock(&lock);
+
+  chunk_bounds(0, chunks, num_items, &first, &last);
+  fun(arg, first, last);
+
+  pthread_mutex_lock(&lock);
+  while (pending)
+    pthread_cond_wait(&done_cond, &lock);
+  pthread_mutex_unlock(&lock);
+}
+
+
+void workers_fini()
+{
+  int i;
+
+  if (!threads)
+    return;
+
+  pthread_mutex_lock(&lock);
+  quit = 1;
+  pthread_cond_broadcast(&start_cond);
+  pthread_mutex_unlock(&lock);
+
+  for(i = 1; i < num_jobs; i++)
+    pthread_join(threads[i - 1], NULL);
+  free(threads);
+  threads = NULL;
+  num_jobs = 1;
+  quit = 0;
+}
+
+#else  /* no pthread: everything is done by the calling thread */
+
+int workers_init(int jobs)
+{
+  if (jobs > 1)
+    debug_printf("Worker pool not available, using 1 job\n");
+  return num_jobs;
+}
+
+
+void workers_run(work_fun_t fun, void* arg, int num_items)
+{
+  fun(arg, 0, num_items);
+}
+
+
+void workers_fini()
+{
+}
+
+#endif  /* HAVE_LIBPTHREAD */
+
+
+int workers_num()
+{
+  return num_jobs;
+}
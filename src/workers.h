@@ -0,0 +1,22 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+#ifndef _WORKERS_H
+#define _WORKERS_H
+
+/* Work on the items [first, last) of some array described by 'arg'. */
+typedef void (*work_fun_t)(void* arg, int first, int last);
+
+int  workers_init(int num_jobs);
+int  workers_num(void);
+void workers_run(work_fun_t fun, void* arg, int num_items);
+void workers_fini(void);
+
+#endif  /* _WORKERS_H */
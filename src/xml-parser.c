@@ -71,6 +71,12 @@ static void option_update(xmlChar* name, xmlChar* val, struct option* opt)
   if(!xmlStrcmp(name, (xmlChar *) "max_iter"))
     opt->max_iter = atoi((char*)val);
 
+  if(!xmlStrcmp(name, (xmlChar *) "jobs")) {
+    opt->num_jobs = atoi((char*)val);
+    if (opt->num_jobs < 1)
+      opt->num_jobs = 1;
+  }
+
   if(!xmlStrcmp(name, (xmlChar *) "show_timestamp"))
     opt->show_timestamp = (opt->show_timestamp || atoi((char*)val));
 
@@ -82,6 +88,21 @@ static void option_update(xmlChar* name, xmlChar* val, struct option* opt)
 
   if(!xmlStrcmp(name, (const xmlChar *) "sticky"))
     opt->sticky = atoi((const char*)val);
+
+  if(!xmlStrcmp(name, (const xmlChar *) "cgroup")) {
+    if (opt->cgroup_dir)
+      free(opt->cgroup_dir);
+    opt->cgroup_dir = strdup((const char*)val);
+  }
+
+  if(!xmlStrcmp(name, (const xmlChar *) "only_cgroup")) {
+    if (opt->only_cgroup)
+      free(opt->only_cgroup);
+    opt->only_cgroup = strdup((const char*)val);
+  }
+
+  if(!xmlStrcmp(name, (const xmlChar *) "per_cpu"))
+    opt->per_cpu = (opt->per_cpu || atoi((const char*)val));
 }
 
 
@@ -0,0 +1,215 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Evaluate the columns of the built-in screens for many tasks, with
+   the tree walker that the compiled programs replaced (a copy of it
+   is below), and with run_program, one task at a time as rows used to
+   be built, and all the tasks at once. The tasks are made up: the
+   cost of an evaluation does not depend on where the values come
+   from. */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "process.h"
+#include "screen.h"
+#include "utils-expression.h"
+
+#define NUM_TASKS 1000
+#define ITER 200
+
+
+/* The tree walker, as it was in utils-expression.c: the aliases are
+   looked up at each leaf, for each task. */
+static double get_counter_value(unit* e, counter_t* tab, int nbc, char delta,
+                                struct process* p, int* error)
+{
+  int id;
+
+  if (strcmp(e->alias, "CPU_TOT") == 0)
+    return p->cpu_percent;
+  if (strcmp(e->alias, "CPU_SYS") == 0)
+    return p->cpu_percent_s;
+  if (strcmp(e->alias, "CPU_USER") == 0)
+    return p->cpu_percent_u;
+  if (strcmp(e->alias, "RUN_RATIO") == 0) {
+    if (p->run_ratio >= 0)
+      return p->run_ratio;
+    *error = 1;
+    return 1;
+  }
+  if (strcmp(e->alias, "PROC_ID") == 0) {
+    if (p->proc_id != -1)
+      return (double)p->proc_id;
+    *error = 1;
+    return 1;
+  }
+  for(id = 0; id < nbc; id++) {
+    if (strcmp(e->alias, tab[id].alias) == 0)
+      break;
+  }
+  if ((id == nbc) || (p->values[id] == 0xffffffff)) {
+    *error = 1;
+    return 1;
+  }
+  if (delta == DELT)
+    return (double)(p->values[id] - p->prev_values[id]);
+  if (delta == PERSEC) {
+    if (p->interval <= 0) {
+      *error = 2;
+      return 0;
+    }
+    return (double)(p->values[id] - p->prev_values[id]) / p->interval;
+  }
+  return (double)p->values[id];
+}
+
+
+static double walk(expression* e, counter_t* c, int nbc,
+                   struct process* p, int* error)
+{
+  if (e == NULL) {
+    *error = 1;
+    return 0;
+  }
+  *error = 0;
+  if (e->type == ELEM) {
+    if (e->ele->type == COUNT)
+      return get_counter_value(e->ele, c, nbc, e->ele->delta, p, error);
+    return e->ele->val;
+  }
+  switch(e->op->operator) {
+  case '+':
+    return walk(e->op->exp1, c, nbc, p, error) +
+           walk(e->op->exp2, c, nbc, p, error);
+  case '-':
+    return walk(e->op->exp1, c, nbc, p, error) -
+           walk(e->op->exp2, c, nbc, p, error);
+  case '*':
+    return walk(e->op->exp1, c, nbc, p, error) *
+           walk(e->op->exp2, c, nbc, p, error);
+  case '/': {
+    double tmp = walk(e->op->exp2, c, nbc, p, error);
+    if (tmp == 0) {
+      *error = 2;
+      return 0;
+    }
+    return walk(e->op->exp1, c, nbc, p, error) / tmp;
+  }
+  default:  /* functions over time: the current value */
+    return walk(e->op->exp1, c, nbc, p, error);
+  }
+}
+
+
+static void make_tasks(struct process* tasks, struct process** ptrs)
+{
+  int i, zz;
+
+  for(i = 0; i < NUM_TASKS; i++) {
+    struct process* const p = &tasks[i];
+
+    memset(p, 0, sizeof(*p));
+    p->tid = p->pid = i + 1;
+    p->num_events = MAX_EVENTS;
+    for(zz = 0; zz < MAX_EVENTS; zz++) {
+      p->prev_values[zz] = rand() % 1000000;
+      p->values[zz] = p->prev_values[zz] + rand() % 1000000 + 1;
+    }
+    p->cpu_percent = rand() % 100;
+    p->cpu_percent_s = p->cpu_percent / 3;
+    p->cpu_percent_u = p->cpu_percent - p->cpu_percent_s;
+    p->run_ratio = 1;
+    p->proc_id = i % 4;
+    p->interval = 1;
+    p->timestamp.tv_sec = 1;
+    ptrs[i] = p;
+  }
+}
+
+
+int main(void)
+{
+  static struct process tasks[NUM_TASKS];
+  static struct process* ptrs[NUM_TASKS];
+  double* res;
+  char*   err;
+  double  t0, t_walk = 0, t_row = 0, t_prog = 0, sink = 0;
+  int     num_columns = 0, s_id, i, it;
+
+  init_screen();
+  make_tasks(tasks, ptrs);
+
+  for(s_id = 0; s_id < get_num_screens(); s_id++) {
+    screen_t* const s = get_screen(s_id);
+    const int nc = s->num_columns;
+
+    num_columns += nc;
+    res = malloc(nc * NUM_TASKS * sizeof(double) + 1);
+    err = malloc(nc * NUM_TASKS + 1);
+
+    /* same results, where there is no error */
+    run_program(s->program, ptrs, NUM_TASKS, res, err);
+    for(i = 0; i < NUM_TASKS; i++) {
+      int c;
+      for(c = 0; c < nc; c++) {
+        int e;
+        double v = walk(s->columns[c].expression, s->counters,
+                        s->num_counters, ptrs[i], &e);
+        if (!e && !err[c * NUM_TASKS + i])
+          CHECK(fabs(v - res[c * NUM_TASKS + i]) <= 1e-9 * fabs(v));
+      }
+    }
+
+    t0 = now();
+    for(it = 0; it < ITER; it++) {
+      for(i = 0; i < NUM_TASKS; i++) {
+        int c, e;
+        for(c = 0; c < nc; c++)
+          sink += walk(s->columns[c].expression, s->counters,
+                       s->num_counters, ptrs[i], &e);
+      }
+    }
+    t_walk += now() - t0;
+
+    t0 = now();
+    for(it = 0; it < ITER; it++) {
+      for(i = 0; i < NUM_TASKS; i++) {
+        run_program(s->program, &ptrs[i], 1, res, err);
+        sink += res[0];
+      }
+    }
+    t_row += now() - t0;
+
+    t0 = now();
+    for(it = 0; it < ITER; it++) {
+      run_program(s->program, ptrs, NUM_TASKS, res, err);
+      sink += res[0];
+    }
+    t_prog += now() - t0;
+
+    free(res);
+    free(err);
+  }
+
+  printf("%d screens, %d columns, per task:  tree walker %6.0f ns   "
+         "program %6.0f ns  (x%.1f)\n", get_num_screens(), num_columns,
+         t_walk / ITER / NUM_TASKS * 1e9, t_prog / ITER / NUM_TASKS * 1e9,
+         t_walk / t_prog);
+  printf("program, per task:  one task at a time %6.0f ns   "
+         "%d at once %6.0f ns  (x%.1f)\n", t_row / ITER / NUM_TASKS * 1e9,
+         NUM_TASKS, t_prog / ITER / NUM_TASKS * 1e9, t_row / t_prog);
+  if (sink == 42)  /* keep the results alive */
+    printf("\n");
+  return check_status();
+}
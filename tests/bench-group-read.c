@@ -0,0 +1,105 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Read the counters of a task one by one, each counter with its own
+   read, as before counter groups, and as a group with
+   PERF_FORMAT_GROUP, one read for all (see read_group in process.c).
+
+   Software events are used, they are available everywhere, even
+   without a PMU. The cost of read is the same for hardware events. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "pmc.h"
+
+#define NUM_EVENTS 6
+#define ITER 100000
+
+static const uint64_t configs[NUM_EVENTS] = {
+  PERF_COUNT_SW_TASK_CLOCK,
+  PERF_COUNT_SW_CONTEXT_SWITCHES,
+  PERF_COUNT_SW_PAGE_FAULTS,
+  PERF_COUNT_SW_CPU_MIGRATIONS,
+  PERF_COUNT_SW_PAGE_FAULTS_MIN,
+  PERF_COUNT_SW_PAGE_FAULTS_MAJ
+};
+
+
+static int open_events(int fds[], int group)
+{
+  struct STRUCT_NAME attr;
+  int i;
+
+  for(i = 0; i < NUM_EVENTS; i++) {
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = configs[i];
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    if (group)
+      attr.read_format |= PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    fds[i] = perf_event_open(&attr, 0, -1, (group && i) ? fds[0] : -1, 0);
+    if (fds[i] == -1) {
+      fprintf(stderr, "perf_event_open: %s\n", strerror(errno));
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+static void close_events(int fds[])
+{
+  int i;
+  for(i = 0; i < NUM_EVENTS; i++)
+    close(fds[i]);
+}
+
+
+int main(void)
+{
+  uint64_t buf[3 + NUM_EVENTS];
+  int fds[NUM_EVENTS];
+  double t0, t_single, t_group;
+  int i, zz;
+
+  if (open_events(fds, 0) == -1)
+    return 1;
+  t0 = now();
+  for(i = 0; i < ITER; i++) {
+    for(zz = 0; zz < NUM_EVENTS; zz++)
+      CHECK(read(fds[zz], buf, 3 * sizeof(uint64_t)) ==
+            3 * sizeof(uint64_t));
+  }
+  t_single = now() - t0;
+  close_events(fds);
+
+  if (open_events(fds, 1) == -1)
+    return 1;
+  t0 = now();
+  for(i = 0; i < ITER; i++) {
+    CHECK(read(fds[0], buf, sizeof(buf)) == sizeof(buf));
+  }
+  t_group = now() - t0;
+  CHECK(buf[0] == NUM_EVENTS);
+  close_events(fds);
+
+  printf("%d counters, per task:  one read each %6.0f ns   "
+         "group read %6.0f ns  (x%.1f)\n", NUM_EVENTS,
+         t_single / ITER * 1e9, t_group / ITER * 1e9, t_single / t_group);
+  return check_status();
+}
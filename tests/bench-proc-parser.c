@@ -0,0 +1,122 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Parse the stat file of a task with proc-parser.c, and with the
+   fscanf formats it replaced. The line is parsed from memory, to
+   measure the parsers alone, then read from /proc each time, as done
+   at each refresh. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "proc-parser.h"
+
+#define PARSE_ITER 200000
+#define READ_ITER   20000
+
+
+/* The formats of the former fscanf path (state, utime, stime, then
+   the processor), on a buffer. */
+static int scanf_stat(const char* buf, struct task_stat* st)
+{
+  int n, pos = 0;
+
+  n = sscanf(buf,
+             "%*d (%*[^)]) %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu%n",
+             &st->state, &st->utime, &st->stime, &pos);
+  if (n != 3)
+    return -1;
+  n = sscanf(buf + pos,
+             "%*d %*d %*d %*d %*d %*d %*d %*u %*d %*u %*u %*u %*u "
+             "%*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %d",
+             &st->processor);
+  if (n != 1)
+    st->processor = -1;
+  return 0;
+}
+
+
+static int fscanf_stat(const char* path, struct task_stat* st)
+{
+  FILE* f = fopen(path, "r");
+  int n;
+
+  if (!f)
+    return -1;
+  n = fscanf(f,
+             "%*d (%*[^)]) %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+             &st->state, &st->utime, &st->stime);
+  if (n == 3) {
+    n = fscanf(f,
+               "%*d %*d %*d %*d %*d %*d %*d %*u %*d %*u %*u %*u %*u "
+               "%*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %d",
+               &st->processor);
+    if (n != 1)
+      st->processor = -1;
+    n = 3;
+  }
+  fclose(f);
+  return (n == 3) ? 0 : -1;
+}
+
+
+int main(void)
+{
+  const char* const path = "/proc/self/stat";
+  struct task_stat a, b;
+  char buf[1024];
+  double t0, t_scanf, t_parse, t_fscanf, t_read;
+  int i;
+
+  if (read_proc_file(path, buf, sizeof(buf)) <= 0) {
+    perror(path);
+    return 1;
+  }
+
+  /* both parsers agree */
+  CHECK(scanf_stat(buf, &a) == 0);
+  CHECK(parse_stat(buf, &b) == 0);
+  CHECK(a.state == b.state);
+  CHECK(a.utime == b.utime);
+  CHECK(a.stime == b.stime);
+  CHECK(a.processor == b.processor);
+
+  t0 = now();
+  for(i = 0; i < PARSE_ITER; i++)
+    scanf_stat(buf, &a);
+  t_scanf = now() - t0;
+
+  t0 = now();
+  for(i = 0; i < PARSE_ITER; i++)
+    parse_stat(buf, &b);
+  t_parse = now() - t0;
+
+  t0 = now();
+  for(i = 0; i < READ_ITER; i++)
+    fscanf_stat(path, &a);
+  t_fscanf = now() - t0;
+
+  t0 = now();
+  for(i = 0; i < READ_ITER; i++) {
+    read_proc_file(path, buf, sizeof(buf));
+    parse_stat(buf, &b);
+  }
+  t_read = now() - t0;
+
+  printf("parse in memory:  sscanf %7.0f ns   parse_stat %7.0f ns  (x%.1f)\n",
+         t_scanf / PARSE_ITER * 1e9, t_parse / PARSE_ITER * 1e9,
+         t_scanf / t_parse);
+  printf("read from /proc:  fscanf %7.0f ns   read+parse %7.0f ns  (x%.1f)\n",
+         t_fscanf / READ_ITER * 1e9, t_read / READ_ITER * 1e9,
+         t_fscanf / t_read);
+  return check_status();
+}
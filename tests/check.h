@@ -0,0 +1,49 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Helpers shared by the tests and the benchmarks. */
+
+#ifndef _CHECK_H
+#define _CHECK_H
+
+#include <stdio.h>
+#include <time.h>
+
+static int failures = 0;
+
+/* Report a failed condition, and keep going. */
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "%s:%d: check failed: %s\n",                      \
+              __FILE__, __LINE__, #cond);                               \
+      failures++;                                                       \
+    }                                                                   \
+  } while (0)
+
+
+/* Status of the test program. */
+static inline int check_status(void)
+{
+  if (failures)
+    fprintf(stderr, "%d check(s) failed\n", failures);
+  return failures ? 1 : 0;
+}
+
+
+/* Monotonic time, in seconds. */
+static inline double now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+#endif  /* _CHECK_H */
@@ -0,0 +1,113 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Row of a process when threads are hidden, and the kernel cannot
+   count per process (before Linux 5.13): the counters of the threads
+   are added up in the row of the process by accumulate_stats. Its
+   delta must be the sum of the deltas of the threads, at each
+   refresh, not only the first one.
+
+   The counter is the task clock, in nanoseconds: the delta of the
+   process cannot exceed the elapsed time on all the CPUs. */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "error.h"
+#include "options.h"
+#include "pmc.h"
+#include "process.h"
+#include "screen.h"
+
+#define NUM_THREADS 2
+#define NUM_ITER 5
+
+static volatile int stop = 0;
+
+static void* spin(void* arg)
+{
+  while (!stop)
+    ;
+  return arg;
+}
+
+
+int main(void)
+{
+  struct option options;
+  struct process_list* list;
+  pthread_t threads[NUM_THREADS];
+  screen_t* s;
+  double t0, t1;
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int i, it;
+
+  init_options(&options);
+  options.show_threads = 1;
+  init_errors(1, NULL);
+
+  s = new_screen("test", "task clock", 0);
+  add_counter_by_value(s, "TCLK", PERF_TYPE_SOFTWARE,
+                       PERF_COUNT_SW_TASK_CLOCK);
+  add_column(s, "  tclk", "%6.0f", "task clock", "delta(TCLK)");
+  tamp_counters();
+
+  for(i = 0; i < NUM_THREADS; i++)
+    pthread_create(&threads[i], NULL, spin, NULL);
+
+  list = init_proc_list(&options);
+  list->inherit = 0;  /* as on kernels without inherit_thread */
+  options.show_threads = 0;
+
+  t0 = now();
+  for(it = 0; it < NUM_ITER; it++) {
+    struct process* owner = NULL;
+    uint64_t sum = 0;
+    struct process* p;
+
+    update_proc_list(list, s, &options);
+    t1 = now();
+    accumulate_stats(list);
+
+    for(p = list->processes; p; p = p->next) {
+      if (p->pid != getpid())
+        continue;
+      if (p->tid == p->pid)
+        owner = p;
+      else
+        sum += p->values[0] - p->prev_values[0];
+    }
+    CHECK(owner != NULL);
+    if (!owner)
+      break;
+    sum += owner->own_values[0] - owner->own_prev_values[0];
+
+    if (it > 0) {  /* a full period since the previous refresh */
+      const uint64_t delta = owner->values[0] - owner->prev_values[0];
+      CHECK(owner->values[0] != 0xffffffff);
+      CHECK(delta == sum);
+      CHECK(delta <= (t1 - t0) * 1e9 * ncpus * 1.1);
+      CHECK(delta >= (t1 - t0) * 1e9 * 0.5);  /* the threads spin */
+    }
+    t0 = t1;
+    usleep(100000);
+  }
+
+  stop = 1;
+  for(i = 0; i < NUM_THREADS; i++)
+    pthread_join(threads[i], NULL);
+  done_proc_list(list);
+  delete_screen(s);
+  return check_status();
+}
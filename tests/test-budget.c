@@ -0,0 +1,155 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Files budget, at the limit: tasks are evicted, the counters rotate
+   among them, some tasks die and are freed by compact_proc_list, then
+   the counters change (key press) and the next refreshes rotate
+   again. The heaps of budget.c must never return a freed task.
+
+   Freed memory is filled with a pattern that makes a task look alive
+   (not dead, evicted, with counters), so that a stale pointer in
+   the heaps is noticed instead of silently skipped. */
+
+#include <malloc.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "budget.h"
+#include "check.h"
+#include "error.h"
+#include "options.h"
+#include "pmc.h"
+#include "process.h"
+#include "screen.h"
+
+#define NUM_CHILDREN 16
+#define FILES_LIMIT 40  /* 30 files for the counters, see init_proc_list */
+
+
+/* Is 'p' one of the tasks of 'list' (or NULL)? */
+static int in_list(const struct process_list* const list,
+                   const struct process* const p)
+{
+  int i;
+
+  if (!p)
+    return 1;
+  for(i = 0; i < list->num_tids; i++) {
+    if (list->proc_ptrs[i] == p)
+      return 1;
+  }
+  return 0;
+}
+
+
+/* Go through both heaps, as evictions and re-attachments would: every
+   task must still be in the list. The heaps are rebuilt afterwards. */
+static void check_heaps(struct process_list* const list,
+                        const struct option* const options)
+{
+  struct process* p;
+
+  while ((p = budget_coldest(options))) {
+    CHECK(in_list(list, p));
+    budget_pop_coldest();
+  }
+  while ((p = budget_hottest(options))) {
+    CHECK(in_list(list, p));
+    budget_pop_hottest();
+  }
+  budget_invalidate(list);
+}
+
+
+int main(void)
+{
+  struct option options;
+  struct process_list* list;
+  struct rlimit lim;
+  pid_t children[NUM_CHILDREN];
+  screen_t *s1, *s2;
+  int i, it;
+
+  /* dead: 0, evicted: 1, fd[]: not -1 */
+  mallopt(M_PERTURB, 0x6a);
+
+  getrlimit(RLIMIT_NOFILE, &lim);
+  lim.rlim_cur = FILES_LIMIT;
+  if (setrlimit(RLIMIT_NOFILE, &lim) == -1) {
+    perror("setrlimit");
+    return 1;
+  }
+
+  init_options(&options);
+  options.show_threads = 1;
+  init_errors(1, "/dev/null");
+
+  s1 = new_screen("one", "task clock", 0);
+  add_counter_by_value(s1, "TCLK", PERF_TYPE_SOFTWARE,
+                       PERF_COUNT_SW_TASK_CLOCK);
+  add_column(s1, "  tclk", "%6.0f", "task clock", "delta(TCLK)");
+  s2 = new_screen("two", "task clock and switches", 0);
+  add_counter_by_value(s2, "TCLK", PERF_TYPE_SOFTWARE,
+                       PERF_COUNT_SW_TASK_CLOCK);
+  add_counter_by_value(s2, "CS", PERF_TYPE_SOFTWARE,
+                       PERF_COUNT_SW_CONTEXT_SWITCHES);
+  add_column(s2, "  tclk", "%6.0f", "task clock", "delta(TCLK)");
+  add_column(s2, "    cs", "%6.0f", "switches", "delta(CS)");
+  tamp_counters();
+
+  for(i = 0; i < NUM_CHILDREN; i++) {
+    children[i] = fork();
+    if (children[i] == 0) {
+      pause();
+      _exit(0);
+    }
+  }
+
+  list = init_proc_list(&options);
+  for(it = 0; it < 3; it++) {
+    update_proc_list(list, s1, &options);
+    usleep(20000);
+  }
+  CHECK(num_evicted_tasks() > 0);
+
+  /* Half the children die. The heaps are built at the next refresh,
+     before the children are found dead, and freed. */
+  for(i = 0; i < NUM_CHILDREN; i += 2) {
+    kill(children[i], SIGKILL);
+    waitpid(children[i], NULL, 0);
+  }
+  update_proc_list(list, s1, &options);
+  compact_proc_list(list);
+  check_heaps(list, &options);
+
+  /* same, then a key press: new counters, at the files limit */
+  for(i = 1; i < NUM_CHILDREN; i += 2) {
+    kill(children[i], SIGKILL);
+    waitpid(children[i], NULL, 0);
+  }
+  update_proc_list(list, s1, &options);
+  compact_proc_list(list);
+  CHECK(switch_counters(list, s1, s2, &options) == 0);
+  check_heaps(list, &options);
+
+  /* next refreshes rotate the counters among the evicted tasks */
+  for(it = 0; it < 3; it++) {
+    update_proc_list(list, s2, &options);
+    compact_proc_list(list);
+    check_heaps(list, &options);
+    usleep(20000);
+  }
+
+  done_proc_list(list);
+  return check_status();
+}
@@ -0,0 +1,207 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* A task monitored because of its name (-p NAME) calls exec and gets
+   another name: the exec event of the kernel must drop it, as a scan
+   of /proc would not have found it. Without the proc connector (no
+   CAP_NET_ADMIN), there is nothing to test.
+
+   The other way round, a task filtered out by a scan of /proc calls
+   exec and gets a name that passes the filter: the next scan must
+   find it, even though it is the same process. */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "error.h"
+#include "options.h"
+#include "pmc.h"
+#include "proc-events.h"
+#include "process.h"
+#include "screen.h"
+
+
+static struct process* find_task(const struct process_list* const list,
+                                 pid_t tid)
+{
+  int i;
+
+  for(i = 0; i < list->num_tids; i++) {
+    if (list->proc_ptrs[i]->tid == tid)
+      return list->proc_ptrs[i];
+  }
+  return NULL;
+}
+
+
+/* Wait until the child has executed the new program. */
+static int wait_exec(pid_t pid, const char* name)
+{
+  char path[50], comm[32];
+  int  i;
+
+  snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+  for(i = 0; i < 200; i++) {
+    FILE* f = fopen(path, "r");
+    if (f) {
+      int n = fscanf(f, "%31s", comm);
+      fclose(f);
+      if ((n == 1) && (strcmp(comm, name) == 0))
+        return 0;
+    }
+    usleep(10000);
+  }
+  return -1;
+}
+
+
+/* A child, named test-exec until it is told to exec sleep through
+   the pipe 'fd'. */
+static pid_t start_child(int* fd)
+{
+  int   pipefd[2];
+  pid_t child;
+  char  go;
+
+  if (pipe(pipefd) == -1) {
+    perror("pipe");
+    exit(1);
+  }
+  child = fork();
+  if (child == 0) {
+    close(pipefd[1]);
+    if (read(pipefd[0], &go, 1) != 1)
+      _exit(1);
+    execlp("sleep", "sleep", "10", (char*)NULL);
+    _exit(1);
+  }
+  close(pipefd[0]);
+  *fd = pipefd[1];
+  return child;
+}
+
+
+static void stop_child(pid_t child, int fd)
+{
+  kill(child, SIGKILL);
+  waitpid(child, NULL, 0);
+  close(fd);
+}
+
+
+/* Monitored, then filtered out by its exec. */
+static void exec_out(screen_t* s)
+{
+  struct option options;
+  struct process_list* list;
+  struct process* p;
+  pid_t child;
+  int   fd;
+  char  go = 1;
+
+  init_options(&options);
+  options.show_threads = 1;
+  options.only_name = strdup("test-exec");
+
+  child = start_child(&fd);
+  list = init_proc_list(&options);
+  if (!proc_events_active()) {
+    printf("no process events, skipped\n");
+    stop_child(child, fd);
+    done_proc_list(list);
+    return;
+  }
+  update_proc_list(list, s, &options);
+  CHECK(find_task(list, child) != NULL);
+  CHECK(find_task(list, getpid()) != NULL);
+
+  /* named sleep now: filtered out */
+  CHECK(write(fd, &go, 1) == 1);
+  CHECK(wait_exec(child, "sleep") == 0);
+  update_proc_list(list, s, &options);
+  p = find_task(list, child);
+  CHECK(p == NULL || p->dead);
+  compact_proc_list(list);
+  CHECK(find_task(list, child) == NULL);
+  CHECK(find_task(list, getpid()) != NULL);
+
+  /* it does not come back */
+  update_proc_list(list, s, &options);
+  CHECK(find_task(list, child) == NULL);
+
+  stop_child(child, fd);
+  done_proc_list(list);
+}
+
+
+/* Filtered out by a scan of /proc, then passes the filter after its
+   exec. */
+static void exec_in(screen_t* s)
+{
+  struct option options;
+  struct process_list* list;
+  struct process* p;
+  pid_t child, other;
+  int   fd;
+  char  go = 1;
+
+  init_options(&options);
+  options.show_threads = 1;
+  options.only_name = strdup("sleep");
+
+  child = start_child(&fd);
+  list = init_proc_list(&options);
+  proc_events_fini();  /* scan /proc */
+
+  update_proc_list(list, s, &options);
+  CHECK(find_task(list, child) == NULL);
+  CHECK(find_task(list, getpid()) == NULL);
+
+  /* named sleep now. The scans of /proc only happen when there is a
+     new process. */
+  CHECK(write(fd, &go, 1) == 1);
+  CHECK(wait_exec(child, "sleep") == 0);
+  other = fork();
+  if (other == 0)
+    _exit(0);
+  waitpid(other, NULL, 0);
+  update_proc_list(list, s, &options);
+  p = find_task(list, child);
+  CHECK(p != NULL && !p->dead);
+  CHECK(find_task(list, getpid()) == NULL);
+
+  stop_child(child, fd);
+  done_proc_list(list);
+}
+
+
+int main(void)
+{
+  screen_t* s;
+
+  init_errors(1, "/dev/null");
+
+  s = new_screen("test", "task clock", 0);
+  add_counter_by_value(s, "TCLK", PERF_TYPE_SOFTWARE,
+                       PERF_COUNT_SW_TASK_CLOCK);
+  add_column(s, "  tclk", "%6.0f", "task clock", "delta(TCLK)");
+  tamp_counters();
+
+  exec_out(s);
+  exec_in(s);
+
+  delete_screen(s);
+  return check_status();
+}
@@ -0,0 +1,250 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Parse expressions with the scanner of calc-lex.c and the parser of
+   calc.y, and compare the trees, printed by build_expression, with
+   what the rules of calc.lex gave.
+
+   The parameters of the functions over time are checked: a column
+   with a weight of ewma outside ]0, 1], or a window that is not an
+   integer in [1, WINDOW_MAX], is refused. The first sample of a task
+   is the value of all of them. */
+
+#define _GNU_SOURCE  /* open_memstream */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "error.h"
+#include "pmc.h"
+#include "process.h"
+#include "screen.h"
+#include "utils-expression.h"
+
+
+/* The expression 'txt' as parsed, printed, or NULL if it does not
+   parse. */
+static char* parse(const char* txt)
+{
+  expression* e;
+  char*  buf = NULL;
+  size_t len = 0;
+  FILE*  f;
+
+  e = parser_expression((char*)txt);
+  if (!e)
+    return NULL;
+  f = open_memstream(&buf, &len);
+  build_expression(e, f);
+  fclose(f);
+  free_expression(e);
+  return buf;
+}
+
+
+static void check_parse(const char* txt, const char* expected)
+{
+  char* res = parse(txt);
+
+  if (!expected)
+    CHECK(res == NULL);
+  else {
+    CHECK(res != NULL);
+    if (res && strcmp(res, expected)) {
+      fprintf(stderr, "'%s': '%s' instead of '%s'\n", txt, res, expected);
+      CHECK(0);
+    }
+  }
+  free(res);
+}
+
+
+/* Whether a column of 's' can be 'expr'. */
+static int column_ok(screen_t* s, const char* expr)
+{
+  return add_column(s, "     x", "%6.2f", NULL, (char*)expr) != -1;
+}
+
+
+/* A task at its 'sample'-th update, whose counter went up by 'delta'
+   since the previous one. */
+static void set_sample(struct process* p, int sample, uint64_t delta)
+{
+  p->timestamp.tv_sec = sample;
+  p->interval = 1;
+  p->prev_values[0] = p->values[0];
+  p->values[0] += delta;
+}
+
+
+static void check_history(void)
+{
+  static const char* const exprs[] = {
+    "ewma(delta(TCLK), 0.25)",
+    "wmin(delta(TCLK), 4)",
+    "wmax(delta(TCLK), 4)",
+    "wavg(delta(TCLK), 4)",
+    "delta(TCLK)"
+  };
+  const int nc = sizeof(exprs) / sizeof(exprs[0]);
+  struct process  task;
+  struct process* p = &task;
+  screen_t* s = new_screen("history", "functions over time", 0);
+  double res[6];  /* one more column at the end */
+  char   err[6];
+  int    c;
+
+  add_counter_by_value(s, "TCLK", PERF_TYPE_SOFTWARE,
+                       PERF_COUNT_SW_TASK_CLOCK);
+  for(c = 0; c < nc; c++)
+    CHECK(column_ok(s, exprs[c]));
+  CHECK(s->num_columns == nc);
+
+  memset(&task, 0, sizeof(task));
+  task.tid = task.pid = 1;
+  task.num_events = 1;
+  task.values[0] = 1000;
+
+  /* first sample: no history yet, every function gives the value */
+  set_sample(p, 1, 100);
+  run_program(s->program, &p, 1, res, err);
+  CHECK(task.history != NULL);
+  for(c = 0; c < nc; c++)
+    CHECK((err[c] == 0) && (res[c] == 100));
+
+  /* same sample, the rows built again: not accounted twice */
+  run_program(s->program, &p, 1, res, err);
+  for(c = 0; c < nc; c++)
+    CHECK((err[c] == 0) && (res[c] == 100));
+
+  /* second sample */
+  set_sample(p, 2, 300);
+  run_program(s->program, &p, 1, res, err);
+  CHECK(res[0] == 0.25 * 300 + 0.75 * 100);
+  CHECK(res[1] == 100);
+  CHECK(res[2] == 300);
+  CHECK(res[3] == 200);
+  CHECK(res[4] == 300);
+
+  /* a new program starts a new history, the first sample again */
+  CHECK(column_ok(s, "wavg(delta(TCLK), 2)"));
+  set_sample(p, 3, 50);
+  run_program(s->program, &p, 1, res, err);
+  for(c = 0; c < nc; c++)
+    CHECK((err[c] == 0) && (res[c] == 50));
+
+  free(task.history);
+  delete_screen(s);
+}
+
+
+static void check_parameters(void)
+{
+  screen_t* s = new_screen("parameters", "parameters of the functions", 0);
+  char expr[100];
+
+  add_counter_by_value(s, "TCLK", PERF_TYPE_SOFTWARE,
+                       PERF_COUNT_SW_TASK_CLOCK);
+
+  /* weight of ewma in ]0, 1] */
+  CHECK(column_ok(s, "ewma(delta(TCLK), 1)"));
+  CHECK(column_ok(s, "ewma(delta(TCLK), 0.5)"));
+  CHECK(column_ok(s, "ewma(delta(TCLK), 1e-3)"));
+  CHECK(!column_ok(s, "ewma(delta(TCLK), 0)"));
+  CHECK(!column_ok(s, "ewma(delta(TCLK), 1.5)"));
+  CHECK(!column_ok(s, "ewma(delta(TCLK), -1)"));
+
+  /* window: an integer in [1, WINDOW_MAX] */
+  CHECK(column_ok(s, "wavg(delta(TCLK), 1)"));
+  snprintf(expr, sizeof(expr), "wmax(delta(TCLK), %d)", WINDOW_MAX);
+  CHECK(column_ok(s, expr));
+  snprintf(expr, sizeof(expr), "wmax(delta(TCLK), %d)", WINDOW_MAX + 1);
+  CHECK(!column_ok(s, expr));
+  CHECK(!column_ok(s, "wmin(delta(TCLK), 100000)"));
+  CHECK(!column_ok(s, "wavg(delta(TCLK), 0)"));
+  CHECK(!column_ok(s, "wavg(delta(TCLK), 2.5)"));
+
+  /* also deep in an expression */
+  snprintf(expr, sizeof(expr), "100 * wavg(delta(TCLK), %d) / delta(TCLK)",
+           WINDOW_MAX + 1);
+  CHECK(!column_ok(s, expr));
+  CHECK(!column_ok(s, "wavg(ewma(delta(TCLK), 2), 4)"));
+  CHECK(s->num_columns == 5);
+
+  delete_screen(s);
+}
+
+
+int main(void)
+{
+  char* long_expr;
+  char* res;
+  int   i, n;
+
+  init_errors(1, "/dev/null");
+
+  /* operators, precedence, blanks */
+  check_parse("delta(CYCLE)/delta(INSTR)", "(delta(CYCLE) / delta(INSTR))");
+  check_parse(" 100 *\tdelta( BMISS )\n/ delta(BR)",
+              "((100.00 * delta(BMISS)) / delta(BR))");
+  check_parse("A - B + C", "((A - B) + C)");
+  check_parse("A + B * C", "(A + (B * C))");
+  check_parse("(A + B) * C", "((A + B) * C)");
+  check_parse("rate(A)", "rate(A)");
+  check_parse("CPU_TOT", "CPU_TOT");
+
+  /* constants */
+  check_parse("1.5e3 + 2", "(1500.00 + 2.00)");
+  check_parse("25E-1", "2.50");
+  check_parse("0.125", "0.12");
+
+  /* base 16, and the bitwise operators of the counter definitions */
+  check_parse("0x1F or 0x20 shl 2", "((0x1F or 0x20) shl 2.00)");
+  check_parse("0xa8|A and B shr 1", "(((0xa8 or A) and B) shr 1.00)");
+
+  /* a keyword is a keyword only when the word stops there */
+  check_parse("deltas + rate_x + ewma2", "((deltas + rate_x) + ewma2)");
+  check_parse("delta(delta_x)", "delta(delta_x)");
+
+  /* no digit after the dot or the exponent: not part of the number */
+  check_parse("1.e3", NULL);
+  check_parse("1e+", NULL);
+  check_parse("2e", NULL);  /* 2 followed by counter e */
+
+  /* unknown characters, incomplete expressions */
+  check_parse("A $ B", NULL);
+  check_parse("A +", NULL);
+  check_parse("delta(A", NULL);
+  check_parse("", NULL);
+
+  /* much longer than a buffer of the scanner */
+  n = 500;
+  long_expr = malloc(n * 20);
+  long_expr[0] = '\0';
+  for(i = 0; i < n; i++)
+    strcat(long_expr, i ? " + delta(COUNTER)" : "delta(COUNTER)");
+  res = parse(long_expr);
+  CHECK(res != NULL);
+  if (res) {
+    const char* p;
+    int count = 0;
+    for(p = res; (p = strstr(p, "delta(COUNTER)")); p++)
+      count++;
+    CHECK(count == n);
+  }
+  free(res);
+  free(long_expr);
+
+  check_parameters();
+  check_history();
+
+  return check_status();
+}
@@ -0,0 +1,115 @@
+/*
+ * This file is part of tiptop.
+ *
+ * Author: Erven ROHOU
+ * Copyright (c) 2023 Inria
+ *
+ * License: GNU General Public License version 2.
+ *
+ */
+
+/* Rows that are not tasks: the total row of the system-wide mode, and
+   a cgroup without cpu.stat (cgroup v1, no cpu controller). Like the
+   rows of the tasks, they are timestamped at each refresh, with the
+   time elapsed since the previous one: rate needs it, and the
+   functions over time only account a sample whose timestamp is new. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "error.h"
+#include "options.h"
+#include "pmc.h"
+#include "process.h"
+#include "screen.h"
+#include "utils-expression.h"
+
+#define NUM_ITER 3
+
+
+static struct process* find_row(struct process_list* list, const char* name)
+{
+  struct process* p;
+
+  for(p = list->processes; p; p = p->next) {
+    if (!p->dead && (strcmp(p->name, name) == 0))
+      return p;
+  }
+  return NULL;
+}
+
+
+/* Refresh the rows of 'options' a few times, and check row 'name'. */
+static void check_row(screen_t* s, struct option* options, const char* name)
+{
+  struct process_list* list = init_proc_list(options);
+  struct timeval prev = { 0, 0 };
+  double res[3];
+  char   err[3];
+  int    it;
+
+  for(it = 0; it < NUM_ITER; it++) {
+    struct process* row;
+
+    update_proc_list(list, s, options);
+    row = find_row(list, name);
+    CHECK(row != NULL);
+    if (!row)
+      break;
+
+    run_program(s->program, &row, 1, res, err);
+    CHECK((row->history_stamp.tv_sec == row->timestamp.tv_sec) &&
+          (row->history_stamp.tv_usec == row->timestamp.tv_usec));
+    if (it > 0) {
+      CHECK(timercmp(&row->timestamp, &prev, >));
+      CHECK(row->interval >= 0.05);
+      if (row->values[0] != 0xffffffff)  /* counted: a rate */
+        CHECK(err[0] == 0);
+    }
+    prev = row->timestamp;
+    usleep(100000);
+  }
+  done_proc_list(list);
+}
+
+
+int main(void)
+{
+  struct option options;
+  char   dir[] = "/tmp/test-rows-XXXXXX";
+  char   sub[sizeof(dir) + 8];
+  screen_t* s;
+
+  init_options(&options);
+  init_errors(1, NULL);
+
+  s = new_screen("test", "rows", 0);
+  add_counter_by_value(s, "TCLK", PERF_TYPE_SOFTWARE,
+                       PERF_COUNT_SW_TASK_CLOCK);
+  add_column(s, "  rate", "%6.0f", "task clock per second", "rate(TCLK)");
+  add_column(s, "  ewma", "%6.0f", "smoothed", "ewma(delta(TCLK), 0.5)");
+  tamp_counters();
+
+  /* system-wide mode */
+  options.per_cpu = 1;
+  check_row(s, &options, "total");
+  options.per_cpu = 0;
+
+  /* a directory with no cpu.stat stands for a cgroup */
+  CHECK(mkdtemp(dir) != NULL);
+  snprintf(sub, sizeof(sub), "%s/grp", dir);
+  CHECK(mkdir(sub, 0700) == 0);
+  options.cgroup_dir = strdup(dir);
+  check_row(s, &options, "grp");
+  rmdir(sub);
+  rmdir(dir);
+
+  free_options(&options);
+  delete_screen(s);
+  return check_status();
+}